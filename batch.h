@@ -0,0 +1,213 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "filter.h"
+#include "options.h"
+#include "run.h"
+#include <atomic>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace bsdbx
+{
+
+/**
+ * @brief A test case of a batch.
+ */
+struct BatchCase
+{
+    std::string input;      // File to use as the standard input
+    std::string output{};   // File to write the standard output to, empty to discard it
+    Options options{};      // Options of the case
+    Usage usage{};          // Resource usage of the run
+    bool started = false;   // Whether the case was started, i.e. not skipped after a failure
+    bool ran = false;       // Whether the command of the case could be run
+};
+
+/**
+ * @brief Reads a batch manifest.
+ *
+ * Every line of the manifest describes a test case as "INPUT [OUTPUT] [OPTIONS...]", separated by whitespace, where
+ * the options are the limits of the case with the syntax of the command line. The options of the command line apply
+ * to every case unless overridden. Empty lines and lines starting with '#' are ignored.
+ *
+ * @param path The path of the manifest.
+ * @param base The options of the command line.
+ * @return The test cases.
+ * @throw std::invalid_argument If the manifest cannot be read or a line is malformed.
+ */
+inline std::vector<BatchCase> readManifest(const std::string &path, const Options &base)
+{
+    std::ifstream manifest(path);
+    if (!manifest)
+    {
+        throw std::invalid_argument("Cannot read manifest " + path);
+    }
+    std::vector<BatchCase> cases;
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        std::istringstream stream(line);
+        std::vector<std::string> words;
+        for (std::string word; stream >> word;)
+        {
+            words.push_back(word);
+        }
+        if (words.empty() || words[0][0] == '#')
+        {
+            continue;
+        }
+
+        BatchCase testCase{words[0]};
+        testCase.options = base;
+        std::vector<char *> argv;
+        for (size_t i = 1; i < words.size(); i++)
+        {
+            argv.push_back(words[i].data());
+        }
+        auto rest = applyOptions(testCase.options, argv.size(), argv.data());
+        if (rest.size() > 1)
+        {
+            throw std::invalid_argument("Malformed manifest line: " + line);
+        }
+        if (!rest.empty())
+        {
+            testCase.output = rest[0];
+        }
+        // All the cases share the filter of the command line.
+        testCase.options.mode = base.mode;
+        cases.push_back(std::move(testCase));
+    }
+    return cases;
+}
+
+/**
+ * @brief Runs one executable against every test case of a manifest, in parallel.
+ *
+ * The filter and the command line are prepared once for the whole batch. The cases are handed out to a pool of
+ * workers, each pinned to a CPU of its own in the affinity mask of the sandbox, which the commands inherit. With
+ * options.failFast, the cases not started yet are skipped as soon as one case fails.
+ *
+ * The results are written to options.batchResult, or the standard output, one line per case in the order of the
+ * manifest: the index of the case, the verdict ("OK", "RE", "TLE", "MLE", "OLE", "WA", "SKIP", or "ERROR" if the
+ * files of the case cannot be opened or the command cannot be started), the peak memory in KB, the wall, user and
+ * system times in miliseconds, the exit code of the sandbox and the input file.
+ *
+ * @param options The options of the command line.
+ * @param filter The prepared filter of the mode of the batch.
+ * @param executable The name of the executable to pass to execve, as returned by prepareFilter().
+ * @param envp The environment of the commands.
+ * @return Returns 0 if every case passed, or -1 otherwise.
+ * @throw std::invalid_argument If the manifest cannot be read.
+ * @throw std::runtime_error If the results cannot be written.
+ */
+inline int runBatch(const Options &options, const Filter &filter, const char *executable, char **envp)
+{
+    auto cases = readManifest(options.batch, options);
+
+    cpu_set_t allowed;
+    std::vector<int> cpus;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    int jobs = options.jobs > 0 ? options.jobs : (cpus.empty() ? 1 : cpus.size());
+
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    auto work = [&](int worker) {
+        if (!cpus.empty())
+        {
+            cpu_set_t pinned;
+            CPU_ZERO(&pinned);
+            CPU_SET(cpus[worker % cpus.size()], &pinned);
+            sched_setaffinity(0, sizeof(pinned), &pinned);
+        }
+        for (size_t i; (i = next++) < cases.size();)
+        {
+            if (options.failFast && failed)
+            {
+                break;
+            }
+            auto &testCase = cases[i];
+            testCase.started = true;
+            int stdio[3] = {-1, -1, -1};
+            stdio[0] = open(testCase.input.c_str(), O_RDONLY | O_CLOEXEC);
+            stdio[1] = testCase.output.empty() ? open("/dev/null", O_WRONLY | O_CLOEXEC)
+                                               : open(testCase.output.c_str(),
+                                                      O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (stdio[0] >= 0 && stdio[1] >= 0)
+            {
+                try
+                {
+                    testCase.usage = run(testCase.options, filter, executable, envp, stdio);
+                    testCase.ran = true;
+                }
+                catch (const std::exception &)
+                {
+                }
+            }
+            for (int fd : stdio)
+            {
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+            }
+            if (!testCase.ran || exitCode(testCase.usage) != 0)
+            {
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < jobs; i++)
+    {
+        workers.emplace_back(work, i);
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    std::ofstream file;
+    if (!options.batchResult.empty())
+    {
+        file.open(options.batchResult);
+        if (!file)
+        {
+            throw std::runtime_error("Cannot write " + options.batchResult);
+        }
+    }
+    std::ostream &out = options.batchResult.empty() ? std::cout : file;
+    out << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < cases.size(); i++)
+    {
+        auto &testCase = cases[i];
+        auto &usage = testCase.usage;
+        out << i << ' ' << (testCase.ran ? verdict(usage) : testCase.started ? "ERROR" : "SKIP") << ' '
+            << usage.memory << ' ' << usage.time / 1000.0 << ' ' << usage.userTime / 1000.0 << ' '
+            << usage.systemTime / 1000.0 << ' ' << (testCase.ran ? exitCode(usage) : -1) << ' ' << testCase.input
+            << std::endl;
+    }
+    return failed ? -1 : 0;
+}
+} // namespace bsdbx
+
+#endif // BATCH_H
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <spawn.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/wait.h>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+// Measures how many sandboxed runs a host can launch per second.
+//
+// The harness launches bsdbx on a trivial static binary, first one run after the other and then from several
+// launchers at once. The latency of every launch is compared with launching the binary directly, and the difference
+// is reported as the overhead of the sandbox.
+
+extern char **environ;
+
+namespace
+{
+
+long long nowMicros()
+{
+    timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000LL + spec.tv_nsec / 1000;
+}
+
+/**
+ * @brief Spawns a command with its output discarded and waits for it.
+ *
+ * @return The latency of the launch in microseconds.
+ */
+long long launch(const std::vector<char *> &args)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    auto start = nowMicros();
+    pid_t pid;
+    int result = posix_spawn(&pid, args[0], &actions, nullptr, args.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (result != 0)
+    {
+        throw std::runtime_error(std::string("Failed to spawn ") + args[0]);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    auto latency = nowMicros() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        throw std::runtime_error(std::string("Command failed: ") + args[0]);
+    }
+    return latency;
+}
+
+/**
+ * @brief Launches a command `runs` times from `parallel` launchers.
+ *
+ * @param latencies Receives the latency of every launch in microseconds, sorted.
+ * @return The elapsed time in microseconds.
+ */
+long long measure(const std::vector<char *> &args, int runs, int parallel, std::vector<long long> &latencies)
+{
+    latencies.assign(runs, 0);
+    std::atomic<int> next{0};
+    auto start = nowMicros();
+    std::vector<std::thread> launchers;
+    for (int i = 0; i < parallel; i++)
+    {
+        launchers.emplace_back([&]() {
+            for (int j; (j = next++) < runs;)
+            {
+                latencies[j] = launch(args);
+            }
+        });
+    }
+    for (auto &launcher : launchers)
+    {
+        launcher.join();
+    }
+    auto elapsed = nowMicros() - start;
+    std::sort(latencies.begin(), latencies.end());
+    return elapsed;
+}
+
+long long percentile(const std::vector<long long> &sorted, double p)
+{
+    return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string bsdbx = BSDBX_PATH, target = BSDBX_NOOP_PATH;
+    int runs = 2000;
+    int parallel = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> extra;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg(argv[i]);
+        if (arg == "--")
+        {
+            extra.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        if (i + 1 >= argc)
+        {
+            throw std::invalid_argument("Missing argument for " + std::string(arg));
+        }
+        if (arg == "--bsdbx")
+        {
+            bsdbx = argv[++i];
+        }
+        else if (arg == "--target")
+        {
+            target = argv[++i];
+        }
+        else if (arg == "--runs")
+        {
+            runs = std::stoi(argv[++i]);
+        }
+        else if (arg == "--parallel")
+        {
+            parallel = std::stoi(argv[++i]);
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown argument: " + std::string(arg));
+        }
+    }
+
+    std::vector<char *> direct = {target.data(), nullptr};
+    std::vector<char *> sandboxed = {bsdbx.data(), target.data()};
+    for (auto &arg : extra)
+    {
+        sandboxed.push_back(arg.data());
+    }
+    sandboxed.push_back(nullptr);
+
+    std::cout << std::left << std::setw(12) << "launchers" << std::right << std::setw(12) << "runs/s" << std::setw(12)
+              << "p50 (us)" << std::setw(12) << "p99 (us)" << std::setw(16) << "p50 overhead" << std::setw(16)
+              << "p99 overhead" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    for (int launchers : {1, parallel})
+    {
+        std::vector<long long> baseline, latencies;
+        measure(direct, runs, launchers, baseline);
+        auto elapsed = measure(sandboxed, runs, launchers, latencies);
+        std::cout << std::left << std::setw(12) << launchers << std::right << std::setw(12)
+                  << runs * 1e6 / elapsed << std::setw(12) << percentile(latencies, 0.5) << std::setw(12)
+                  << percentile(latencies, 0.99) << std::setw(16)
+                  << percentile(latencies, 0.5) - percentile(baseline, 0.5) << std::setw(16)
+                  << percentile(latencies, 0.99) - percentile(baseline, 0.99) << std::endl;
+    }
+    return 0;
+}
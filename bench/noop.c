@@ -0,0 +1,5 @@
+// The smallest command worth sandboxing, used to measure the fixed cost of a launch.
+int main(void)
+{
+    return 0;
+}
@@ -0,0 +1,261 @@
+#include "filter.h"
+#include "rule.h"
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <linux/futex.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// Measures the cost of the sandbox filters on a system call, in nanoseconds per call.
+//
+// Every configuration runs in a child process of its own, since a filter cannot be removed once installed. The child
+// installs the filter, runs every microbenchmark and sends the samples back through a pipe.
+
+namespace
+{
+
+/**
+ * @brief A microbenchmark, issuing `calls` system calls per iteration.
+ */
+struct Benchmark
+{
+    const char *name;
+    int calls;
+    void (*run)(long iterations, int fds[2]);
+};
+
+/**
+ * @brief A filter configuration to measure.
+ */
+struct Configuration
+{
+    const char *name;
+    int (*install)();
+};
+
+Benchmark benchmarks[] = {
+    {"getpid", 1,
+     [](long iterations, int *) {
+         for (long i = 0; i < iterations; i++)
+         {
+             syscall(SYS_getpid);
+         }
+     }},
+    {"pipe read/write", 2,
+     [](long iterations, int fds[2]) {
+         char byte = 0;
+         for (long i = 0; i < iterations; i++)
+         {
+             write(fds[1], &byte, 1);
+             read(fds[0], &byte, 1);
+         }
+     }},
+    {"mmap/munmap", 2,
+     [](long iterations, int *) {
+         for (long i = 0; i < iterations; i++)
+         {
+             auto map = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+             munmap(map, 4096);
+         }
+     }},
+    {"futex wake", 1,
+     [](long iterations, int *) {
+         int word = 0;
+         for (long i = 0; i < iterations; i++)
+         {
+             syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+         }
+     }},
+    // Called through syscall(), the vDSO would not enter the kernel at all.
+    {"clock_gettime", 1,
+     [](long iterations, int *) {
+         timespec spec;
+         for (long i = 0; i < iterations; i++)
+         {
+             syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &spec);
+         }
+     }},
+};
+
+int installFilter(bool mode)
+{
+    // The runner execve rule is irrelevant here, any address will do.
+    bsdbx::Filter filter;
+    int result = filter.build(mode, bsdbx::randomExecAddress());
+    return result < 0 ? result : filter.install();
+}
+
+Configuration configurations[] = {
+    {"none", []() { return 0; }},
+    {"general", []() { return bsdbx::loadGeneralRule(); }},
+    {"runner", []() { return installFilter(0); }},
+    {"compiler", []() { return installFilter(1); }},
+};
+
+constexpr size_t BENCHMARK_COUNT = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+long long nowNanos()
+{
+    timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+/**
+ * @brief Runs every microbenchmark under a configuration.
+ *
+ * @return The nanoseconds per system call of every repetition, grouped by benchmark.
+ */
+std::vector<double> measure(const Configuration &configuration, long iterations, int repetitions)
+{
+    std::vector<double> samples(BENCHMARK_COUNT * repetitions);
+    int result[2];
+    if (pipe(result) < 0)
+    {
+        throw std::runtime_error("Failed to create a pipe");
+    }
+    auto pid = fork();
+    if (pid == 0)
+    {
+        close(result[0]);
+        int fds[2];
+        if (pipe(fds) < 0 || configuration.install() < 0)
+        {
+            _exit(1);
+        }
+        for (size_t i = 0; i < BENCHMARK_COUNT; i++)
+        {
+            // Warm up the caches and the branch predictors before measuring.
+            benchmarks[i].run(iterations / 10, fds);
+            for (int j = 0; j < repetitions; j++)
+            {
+                auto start = nowNanos();
+                benchmarks[i].run(iterations, fds);
+                samples[i * repetitions + j] = double(nowNanos() - start) / (iterations * benchmarks[i].calls);
+            }
+        }
+        auto size = samples.size() * sizeof(double);
+        _exit(write(result[1], samples.data(), size) == (ssize_t)size ? 0 : 1);
+    }
+    else if (pid < 0)
+    {
+        throw std::runtime_error("Failed to fork");
+    }
+
+    close(result[1]);
+    auto size = samples.size() * sizeof(double);
+    ssize_t total = 0, n;
+    while (total < (ssize_t)size && (n = read(result[0], (char *)samples.data() + total, size - total)) > 0)
+    {
+        total += n;
+    }
+    close(result[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (total != (ssize_t)size || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        throw std::runtime_error(std::string("Benchmark failed under configuration ") + configuration.name);
+    }
+    return samples;
+}
+
+/**
+ * @brief The summary of the repetitions of a benchmark.
+ */
+struct Statistics
+{
+    double mean, stddev, min;
+};
+
+Statistics summarize(const double *samples, int count)
+{
+    Statistics statistics{0, 0, samples[0]};
+    for (int i = 0; i < count; i++)
+    {
+        statistics.mean += samples[i] / count;
+        statistics.min = std::min(statistics.min, samples[i]);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        statistics.stddev += (samples[i] - statistics.mean) * (samples[i] - statistics.mean) / count;
+    }
+    statistics.stddev = std::sqrt(statistics.stddev);
+    return statistics;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    long iterations = 200000;
+    int repetitions = 10;
+    std::string json;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg(argv[i]);
+        if (i + 1 >= argc)
+        {
+            throw std::invalid_argument("Missing argument for " + std::string(arg));
+        }
+        if (arg == "--iterations")
+        {
+            iterations = std::stol(argv[++i]);
+        }
+        else if (arg == "--repetitions")
+        {
+            repetitions = std::stoi(argv[++i]);
+        }
+        else if (arg == "--json")
+        {
+            json = argv[++i];
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown argument: " + std::string(arg));
+        }
+    }
+
+    std::ofstream out;
+    if (!json.empty())
+    {
+        out.open(json);
+        out << "{\"iterations\":" << iterations << ",\"repetitions\":" << repetitions << ",\"results\":[";
+    }
+
+    std::cout << std::left << std::setw(10) << "filter" << std::setw(18) << "benchmark" << std::right << std::setw(12)
+              << "ns/call" << std::setw(12) << "stddev" << std::setw(12) << "min" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    bool first = true;
+    for (auto &configuration : configurations)
+    {
+        auto samples = measure(configuration, iterations, repetitions);
+        for (size_t i = 0; i < BENCHMARK_COUNT; i++)
+        {
+            auto statistics = summarize(samples.data() + i * repetitions, repetitions);
+            std::cout << std::left << std::setw(10) << configuration.name << std::setw(18) << benchmarks[i].name
+                      << std::right << std::setw(12) << statistics.mean << std::setw(12) << statistics.stddev
+                      << std::setw(12) << statistics.min << std::endl;
+            if (out.is_open())
+            {
+                out << (first ? "" : ",") << "{\"filter\":\"" << configuration.name << "\",\"benchmark\":\""
+                    << benchmarks[i].name << "\",\"mean\":" << statistics.mean << ",\"stddev\":" << statistics.stddev
+                    << ",\"min\":" << statistics.min << "}";
+                first = false;
+            }
+        }
+    }
+
+    if (out.is_open())
+    {
+        out << "]}" << std::endl;
+    }
+    return 0;
+}
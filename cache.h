@@ -0,0 +1,609 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "options.h"
+#include "run.h"
+#include "timing.h"
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace bsdbx
+{
+
+/**
+ * @brief A minimal SHA-256, to name the entries of the compile cache after their content.
+ */
+class Sha256
+{
+  public:
+    Sha256() noexcept = default;
+
+    /**
+     * @brief Hashes more data.
+     */
+    void update(const void *data, size_t size) noexcept
+    {
+        auto bytes = (const uint8_t *)data;
+        length_ += size;
+        while (size > 0)
+        {
+            size_t n = std::min(size, sizeof(block_) - used_);
+            memcpy(block_ + used_, bytes, n);
+            used_ += n;
+            bytes += n;
+            size -= n;
+            if (used_ == sizeof(block_))
+            {
+                compress();
+                used_ = 0;
+            }
+        }
+    }
+
+    /**
+     * @brief Hashes a string, including its terminating NUL so that consecutive strings cannot run into each other.
+     */
+    void update(const std::string &string) noexcept
+    {
+        update(string.c_str(), string.size() + 1);
+    }
+
+    /**
+     * @brief Ends the hash and returns it as 64 hexadecimal digits.
+     */
+    std::string hex() noexcept
+    {
+        uint64_t bits = length_ * 8;
+        uint8_t padding = 0x80;
+        update(&padding, 1);
+        padding = 0;
+        while (used_ != 56)
+        {
+            update(&padding, 1);
+        }
+        uint8_t size[8];
+        for (int i = 0; i < 8; i++)
+        {
+            size[i] = bits >> (56 - 8 * i);
+        }
+        update(size, 8);
+
+        char digits[65];
+        for (int i = 0; i < 8; i++)
+        {
+            snprintf(digits + 8 * i, 9, "%08x", state_[i]);
+        }
+        return std::string(digits, 64);
+    }
+
+  private:
+    static uint32_t rotate(uint32_t x, int n) noexcept
+    {
+        return (x >> n) | (x << (32 - n));
+    }
+
+    void compress() noexcept
+    {
+        static const uint32_t K[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++)
+        {
+            w[i] = (uint32_t)block_[4 * i] << 24 | (uint32_t)block_[4 * i + 1] << 16 |
+                   (uint32_t)block_[4 * i + 2] << 8 | block_[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i++)
+        {
+            auto s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            auto s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+        uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+        for (int i = 0; i < 64; i++)
+        {
+            auto t1 = h + (rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            auto t2 = (rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state_[0] += a;
+        state_[1] += b;
+        state_[2] += c;
+        state_[3] += d;
+        state_[4] += e;
+        state_[5] += f;
+        state_[6] += g;
+        state_[7] += h;
+    }
+
+    uint32_t state_[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                          0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    uint8_t block_[64];
+    size_t used_ = 0;
+    uint64_t length_ = 0;
+};
+
+/**
+ * @brief Copies a whole file into another one, in the kernel where the filesystem allows it.
+ *
+ * @return Returns 0 on success, or -1 on failure with errno set.
+ */
+inline int copyFile(int from, int to) noexcept
+{
+    char buffer[1 << 16];
+    while (true)
+    {
+        auto n = copy_file_range(from, nullptr, to, nullptr, 1 << 30, 0);
+        if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF))
+        {
+            // Not supported between these files, e.g. into a file opened with O_APPEND, fall back to user space.
+            n = read(from, buffer, sizeof(buffer));
+            for (ssize_t written = 0; n > 0 && written < n;)
+            {
+                auto m = write(to, buffer + written, n - written);
+                if (m < 0 && errno != EINTR)
+                {
+                    return -1;
+                }
+                written += m > 0 ? m : 0;
+            }
+        }
+        if (n == 0)
+        {
+            return 0;
+        }
+        if (n < 0 && errno != EINTR)
+        {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief A cache of compilations on local disk, addressed by the content of their inputs.
+ *
+ * The key of a compilation is the SHA-256 of the command line, the identity of the compiler executable (its path,
+ * size, modification time and inode) and the content of every argument naming a regular file, e.g. the sources. Files
+ * only found by the compiler, such as included headers, are not part of the key.
+ *
+ * Every entry is a directory named after its key, holding the artifact, the diagnostics written to the standard
+ * error and the exit code with the mode of the artifact. An entry is filled in a temporary directory and renamed into
+ * place, so that concurrent compilations never see a partial entry, and the first one to finish wins. The cache is
+ * bounded in size: entries are touched when used, and the least recently used ones are removed after an insertion.
+ */
+class CompileCache
+{
+  public:
+    /**
+     * @brief Opens the cache, creating its directory if needed.
+     *
+     * @param directory The directory of the cache.
+     * @param limit The maximum size of the cache in KB.
+     * @return Returns 0 on success, or -1 on failure with errno set.
+     */
+    int open(const std::string &directory, long long limit) noexcept
+    {
+        directory_ = directory;
+        limit_ = limit * 1024;
+        return mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST ? -1 : 0;
+    }
+
+    /**
+     * @brief Computes the key of a compilation.
+     *
+     * @param args The command line, terminated by a nullptr.
+     * @param artifact The path of the artifact, which is left out of the key even if it already exists.
+     * @return The key, or an empty string if the compiler cannot be found.
+     */
+    static std::string key(char *const *args, const std::string &artifact)
+    {
+        struct stat stat;
+        if (::stat(args[0], &stat) < 0)
+        {
+            return "";
+        }
+        Sha256 hash;
+        hash.update("bsdbx-compile-cache-1");
+        long long identity[] = {(long long)stat.st_size, (long long)stat.st_mtim.tv_sec,
+                                (long long)stat.st_mtim.tv_nsec, (long long)stat.st_ino};
+        hash.update(identity, sizeof(identity));
+        for (auto arg = args; *arg != nullptr; arg++)
+        {
+            hash.update(*arg);
+        }
+        for (auto arg = args + 1; *arg != nullptr; arg++)
+        {
+            int fd = artifact == *arg ? -1 : ::open(*arg, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+            if (fd < 0)
+            {
+                continue;
+            }
+            if (fstat(fd, &stat) == 0 && S_ISREG(stat.st_mode))
+            {
+                // The position of the file on the command line is already hashed.
+                char buffer[1 << 16];
+                ssize_t n;
+                while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+                {
+                    hash.update(buffer, n);
+                }
+                hash.update(&stat.st_size, sizeof(stat.st_size));
+            }
+            close(fd);
+        }
+        return hash.hex();
+    }
+
+    /**
+     * @brief Looks up a compilation and restores its result.
+     *
+     * @param key The key of the compilation.
+     * @param artifact The path to restore the artifact to, if the compilation produced one.
+     * @param diagnostics The file descriptor to write the diagnostics to.
+     * @param exitCode Receives the exit code of the compiler.
+     * @return Returns 0 on a hit, or -1 on a miss.
+     */
+    int lookup(const std::string &key, const std::string &artifact, int diagnostics, int &exitCode) noexcept
+    {
+        auto entry = directory_ + "/" + key;
+        int code, mode;
+        if (readStatus(entry, code, mode) < 0)
+        {
+            return -1;
+        }
+        if (mode != 0)
+        {
+            // The artifact replaces the file atomically, like a compiler writing it.
+            int from = ::open((entry + "/artifact").c_str(), O_RDONLY | O_CLOEXEC);
+            auto temporary = artifact + ".XXXXXX";
+            int to = from < 0 ? -1 : mkostemp(temporary.data(), O_CLOEXEC);
+            bool copied = to >= 0 && copyFile(from, to) == 0 && fchmod(to, mode) == 0;
+            if (from >= 0)
+            {
+                close(from);
+            }
+            if (to >= 0)
+            {
+                close(to);
+            }
+            if (!copied || rename(temporary.c_str(), artifact.c_str()) < 0)
+            {
+                if (to >= 0)
+                {
+                    unlink(temporary.c_str());
+                }
+                return -1;
+            }
+        }
+        int from = ::open((entry + "/diagnostics").c_str(), O_RDONLY | O_CLOEXEC);
+        if (from >= 0)
+        {
+            copyFile(from, diagnostics);
+            close(from);
+        }
+        // The modification time of the entry orders the entries for the eviction.
+        utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+        exitCode = code;
+        return 0;
+    }
+
+    /**
+     * @brief Stores the result of a compilation, then evicts the least recently used entries over the size limit.
+     *
+     * An artifact older than the compilation was left by an earlier one, and the compilation is then not stored.
+     *
+     * @param key The key of the compilation.
+     * @param artifact The path of the artifact, which is not stored if it does not exist.
+     * @param diagnostics A file descriptor of the diagnostics, read from its start.
+     * @param exitCode The exit code of the compiler.
+     * @param started The value of CLOCK_REALTIME_COARSE, the clock of the file times, when the compiler was started.
+     * @return Returns 0 on success, or -1 on failure.
+     */
+    int insert(const std::string &key, const std::string &artifact, int diagnostics, int exitCode,
+               const timespec &started) noexcept
+    {
+        int from = ::open(artifact.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat stat;
+        bool regular = from >= 0 && fstat(from, &stat) == 0 && S_ISREG(stat.st_mode);
+        if (regular && (stat.st_mtim.tv_sec < started.tv_sec ||
+                        (stat.st_mtim.tv_sec == started.tv_sec && stat.st_mtim.tv_nsec < started.tv_nsec)))
+        {
+            close(from);
+            return -1;
+        }
+        auto temporary = directory_ + "/.tmp-XXXXXX";
+        if (mkdtemp(temporary.data()) == nullptr)
+        {
+            if (from >= 0)
+            {
+                close(from);
+            }
+            return -1;
+        }
+        bool ok = true;
+        int mode = 0;
+        if (regular)
+        {
+            mode = stat.st_mode & 07777;
+            ok = writeFile(temporary + "/artifact", from);
+        }
+        if (from >= 0)
+        {
+            close(from);
+        }
+        ok = ok && lseek(diagnostics, 0, SEEK_SET) == 0 && writeFile(temporary + "/diagnostics", diagnostics);
+        char status[32];
+        snprintf(status, sizeof(status), "%d %o\n", exitCode, mode);
+        int fd = ::open((temporary + "/status").c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        ok = ok && fd >= 0 && write(fd, status, strlen(status)) == (ssize_t)strlen(status);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        // Another compilation of the same key may have been inserted meanwhile, its entry is as good.
+        if (!ok || rename(temporary.c_str(), (directory_ + "/" + key).c_str()) < 0)
+        {
+            removeEntry(temporary);
+            return ok && (errno == EEXIST || errno == ENOTEMPTY) ? 0 : -1;
+        }
+        evict();
+        return 0;
+    }
+
+  private:
+    static int readStatus(const std::string &entry, int &exitCode, int &mode) noexcept
+    {
+        char buffer[32];
+        int fd = ::open((entry + "/status").c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        auto n = read(fd, buffer, sizeof(buffer) - 1);
+        close(fd);
+        buffer[n > 0 ? n : 0] = '\0';
+        return n > 0 && sscanf(buffer, "%d %o", &exitCode, &mode) == 2 ? 0 : -1;
+    }
+
+    static bool writeFile(const std::string &path, int from) noexcept
+    {
+        int to = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        bool ok = to >= 0 && copyFile(from, to) == 0;
+        if (to >= 0)
+        {
+            close(to);
+        }
+        return ok;
+    }
+
+    static void removeEntry(const std::string &entry) noexcept
+    {
+        for (auto name : {"/artifact", "/diagnostics", "/status"})
+        {
+            unlink((entry + name).c_str());
+        }
+        rmdir(entry.c_str());
+    }
+
+    // Removes the least recently used entries until the cache fits its limit, and temporary entries left behind by
+    // crashed compilations.
+    void evict() noexcept
+    {
+        DIR *directory = opendir(directory_.c_str());
+        if (directory == nullptr)
+        {
+            return;
+        }
+        std::vector<std::pair<long long, std::string>> entries;
+        long long total = 0;
+        try
+        {
+            for (dirent *entry; (entry = readdir(directory)) != nullptr;)
+            {
+                std::string name = entry->d_name;
+                struct stat stat;
+                if (name == "." || name == ".." || ::stat((directory_ + "/" + name).c_str(), &stat) < 0)
+                {
+                    continue;
+                }
+                if (name.compare(0, 5, ".tmp-") == 0)
+                {
+                    if (stat.st_mtime < time(nullptr) - 3600)
+                    {
+                        removeEntry(directory_ + "/" + name);
+                    }
+                    continue;
+                }
+                long long size = 0;
+                for (auto file : {"/artifact", "/diagnostics", "/status"})
+                {
+                    struct stat fileStat;
+                    size += ::stat((directory_ + "/" + name + file).c_str(), &fileStat) == 0 ? fileStat.st_size : 0;
+                }
+                total += size;
+                entries.emplace_back(stat.st_mtim.tv_sec * 1000000000LL + stat.st_mtim.tv_nsec, name);
+            }
+        }
+        catch (...)
+        {
+            closedir(directory);
+            return;
+        }
+        closedir(directory);
+        if (total <= limit_)
+        {
+            return;
+        }
+
+        std::sort(entries.begin(), entries.end());
+        for (auto &[used, name] : entries)
+        {
+            if (total <= limit_)
+            {
+                break;
+            }
+            // A compilation may be reading the entry, move it out of its way first.
+            auto path = directory_ + "/" + name;
+            auto temporary = directory_ + "/.tmp-" + name;
+            if (rename(path.c_str(), temporary.c_str()) == 0)
+            {
+                long long size = 0;
+                for (auto file : {"/artifact", "/diagnostics", "/status"})
+                {
+                    struct stat fileStat;
+                    size += ::stat((temporary + file).c_str(), &fileStat) == 0 ? fileStat.st_size : 0;
+                }
+                removeEntry(temporary);
+                total -= size;
+            }
+        }
+    }
+
+    std::string directory_;
+    long long limit_ = 0;
+};
+
+/**
+ * @brief Returns the artifact of a compilation: options.cacheArtifact, or else the argument following "-o".
+ *
+ * @return The path of the artifact, or an empty string if it cannot be told.
+ */
+inline std::string compileArtifact(const Options &options)
+{
+    if (!options.cacheArtifact.empty())
+    {
+        return options.cacheArtifact;
+    }
+    for (size_t i = 1; i + 1 < options.args.size() && options.args[i + 1] != nullptr; i++)
+    {
+        if (std::string(options.args[i]) == "-o")
+        {
+            return options.args[i + 1];
+        }
+    }
+    return "";
+}
+
+/**
+ * @brief Runs a compilation through the compile cache of options.compileCache.
+ *
+ * On a hit, the artifact and the diagnostics are restored without running the compiler, and the usage is zero with
+ * cached set. On a miss, the standard error of the compiler is collected in a memfd, written to its destination once
+ * the compiler exits, and stored with the artifact only if the compiler succeeded and wrote the artifact. The cache
+ * is bypassed if the compiler cannot be found, so that the run fails as it would without it.
+ *
+ * A compiler able to write to the cache could poison the compilations of others, so spawn() hides the cache from it
+ * with Landlock, and refuses to run if the compiler may write to it. Without Landlock the cache is bypassed.
+ *
+ * See spawn() for the parameters.
+ *
+ * @return The resource usage of the compiler.
+ * @throw std::invalid_argument If the artifact is not known.
+ * @throw std::runtime_error If the cache cannot be opened or the compiler cannot be started.
+ */
+inline Usage runCompile(const Options &options, const Filter &filter, const char *executable, char **envp,
+                        const int stdio[3] = nullptr, PhaseTimer *timer = nullptr, Tracer *tracer = nullptr)
+{
+    auto artifact = compileArtifact(options);
+    if (artifact.empty())
+    {
+        throw std::invalid_argument("The compile cache needs --cache-artifact or -o");
+    }
+    CompileCache cache;
+    if (cache.open(options.compileCache, options.cacheLimit) < 0)
+    {
+        throw std::runtime_error("Failed to open the compile cache");
+    }
+    auto key = CompileCache::key(options.args.data(), artifact);
+    if (key.empty() || !filter.landlock())
+    {
+        return run(options, filter, executable, envp, stdio, timer, tracer);
+    }
+    if (timer != nullptr)
+    {
+        timer->lap("hash");
+    }
+
+    int diagnostics = stdio != nullptr && stdio[2] >= 0 ? stdio[2] : STDERR_FILENO;
+    Usage usage;
+    int code;
+    if (cache.lookup(key, artifact, diagnostics, code) == 0)
+    {
+        usage.status = W_EXITCODE(code, 0);
+        usage.cached = true;
+        if (timer != nullptr)
+        {
+            timer->lap("cache");
+        }
+        return usage;
+    }
+
+    int memfd = memfd_create("bsdbx-diagnostics", MFD_CLOEXEC);
+    if (memfd < 0)
+    {
+        throw std::runtime_error("Failed to create the diagnostics memfd");
+    }
+    int childStdio[3] = {-1, -1, memfd};
+    for (int i = 0; stdio != nullptr && i < 2; i++)
+    {
+        childStdio[i] = stdio[i];
+    }
+    timespec started;
+    clock_gettime(CLOCK_REALTIME_COARSE, &started);
+    try
+    {
+        usage = run(options, filter, executable, envp, childStdio, timer, tracer);
+    }
+    catch (...)
+    {
+        close(memfd);
+        throw;
+    }
+    if (lseek(memfd, 0, SEEK_SET) == 0)
+    {
+        copyFile(memfd, diagnostics);
+    }
+    // The cache is only an optimization, a compilation is not failed because it cannot be stored.
+    if (std::string(verdict(usage)) == "OK")
+    {
+        cache.insert(key, artifact, memfd, 0, started);
+    }
+    close(memfd);
+    if (timer != nullptr)
+    {
+        timer->lap("cache");
+    }
+    return usage;
+}
+} // namespace bsdbx
+
+#endif // CACHE_H
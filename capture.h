@@ -0,0 +1,402 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "compare.h"
+#include "options.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bsdbx
+{
+
+/**
+ * @brief Copies a file into a sealed memfd, to be used as the standard input of the runs.
+ *
+ * The seals make the content immutable, so that every run reads the same input, even if the file changes, and runs
+ * in parallel share a single copy of the pages. Every run needs an offset of its own, see openInput(). A pipe, such
+ * as /dev/stdin, is read until its end.
+ *
+ * @param path The path of the input file.
+ * @return The memfd, or -1 on failure with errno set.
+ */
+inline int sealInput(const std::string &path) noexcept
+{
+    int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+    {
+        return -1;
+    }
+    int memfd = memfd_create("bsdbx-stdin", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    struct stat stat;
+    bool copied = memfd >= 0 && fstat(file, &stat) == 0;
+    if (copied && S_ISREG(stat.st_mode))
+    {
+        copied = ftruncate(memfd, stat.st_size) == 0;
+        for (off_t offset = 0; copied && offset < stat.st_size;)
+        {
+            // sendfile copies from the page cache of the file, without going through user space.
+            auto n = sendfile(memfd, file, &offset, stat.st_size - offset);
+            copied = n > 0 || (n < 0 && errno == EINTR);
+        }
+    }
+    else
+    {
+        char buffer[1 << 16];
+        ssize_t n;
+        while (copied && ((n = read(file, buffer, sizeof(buffer))) != 0))
+        {
+            copied = n > 0 ? write(memfd, buffer, n) == n : errno == EINTR;
+        }
+    }
+    int error = errno;
+    close(file);
+    if (!copied || fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+    {
+        error = copied ? errno : error;
+        if (memfd >= 0)
+        {
+            close(memfd);
+        }
+        errno = error;
+        return -1;
+    }
+    return memfd;
+}
+
+/**
+ * @brief Opens a sealed input for a run, with an offset of its own.
+ *
+ * @param memfd The memfd returned by sealInput().
+ * @return A read-only file descriptor of the input, or -1 on failure with errno set.
+ */
+inline int openInput(int memfd) noexcept
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", memfd);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/**
+ * @brief Captures the standard output of a run through a pipe, and enforces the output limit.
+ *
+ * The supervisor moves the output from the pipe to its destination with splice, so the data does not go through
+ * user space either, and kills the run as soon as it writes more than the limit. If the output is compared against
+ * an expected output, it is read and fed to the comparator on its way instead.
+ *
+ * The supervisor never blocks on the destination: a pipe, FIFO or terminal is reopened without blocking, and a
+ * socket is written with MSG_DONTWAIT. When the destination is full, drain() says so and keeps what it read, and the
+ * supervisor waits for the destination to become writable instead of the pipe to become readable.
+ */
+class OutputCapture
+{
+  public:
+    OutputCapture() = default;
+    OutputCapture(const OutputCapture &) = delete;
+    OutputCapture &operator=(const OutputCapture &) = delete;
+
+    static constexpr size_t BUFFER_SIZE = 1 << 16; // Output read but not written yet, when it is not spliced
+
+    /**
+     * @brief The results of drain().
+     */
+    enum Drained
+    {
+        EXCEEDED = -1, // The output exceeds the limit
+        CLOSED = 0,    // The pipe is closed, or the output is discarded
+        EMPTY = 1,     // The pipe is open and empty
+        BLOCKED = 2,   // The destination is full, wait for target() to become writable
+    };
+
+    ~OutputCapture()
+    {
+        for (int fd : {pipe_[0], pipe_[1], target_})
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+    }
+
+    /**
+     * @brief Creates the pipe.
+     *
+     * @param target The destination of the output, which is duplicated.
+     * @param limit The maximum size of the output in bytes, 0 for unlimited.
+     * @return Returns 0 on success, or -1 on failure.
+     */
+    int open(int target, long long limit) noexcept
+    {
+        struct stat stat;
+        if (fstat(target, &stat) < 0)
+        {
+            return -1;
+        }
+        // A reopened pipe or terminal has flags of its own, so it is made non-blocking without touching the original.
+        if (S_ISFIFO(stat.st_mode) || S_ISCHR(stat.st_mode))
+        {
+            char path[64];
+            snprintf(path, sizeof(path), "/proc/self/fd/%d", target);
+            target_ = ::open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        }
+        if (target_ < 0)
+        {
+            target_ = fcntl(target, F_DUPFD_CLOEXEC, 0);
+        }
+        socket_ = S_ISSOCK(stat.st_mode);
+        limit_ = limit;
+        buffer_.reset(new (std::nothrow) char[BUFFER_SIZE]);
+        // Only the read end is non-blocking, the command sees an ordinary pipe.
+        if (target_ < 0 || buffer_ == nullptr || pipe2(pipe_, O_CLOEXEC) < 0 ||
+            fcntl(pipe_[0], F_SETFL, O_NONBLOCK) < 0)
+        {
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Compares the output against an expected output as it goes through the pipe.
+     *
+     * @return Returns 0 on success, or -1 if the expected output cannot be read.
+     */
+    int compare(const std::string &path, CompareMode mode, double tolerance) noexcept
+    {
+        comparator_ = std::unique_ptr<OutputComparator>(new (std::nothrow) OutputComparator);
+        return comparator_ == nullptr ? -1 : comparator_->open(path, mode, tolerance);
+    }
+
+    /**
+     * @brief Whether the output was found to differ from the expected output.
+     */
+    bool mismatched() const noexcept
+    {
+        return mismatched_;
+    }
+
+    /**
+     * @brief Ends the comparison once the pipe is drained, see OutputComparator::finish().
+     */
+    OutputComparator::Result finish() noexcept
+    {
+        return comparator_->finish();
+    }
+
+    /**
+     * @brief Whether the output is compared against an expected output.
+     */
+    bool comparing() const noexcept
+    {
+        return comparator_ != nullptr;
+    }
+
+    /**
+     * @brief The end of the pipe to use as the standard output of the command.
+     */
+    int writeEnd() const noexcept
+    {
+        return pipe_[1];
+    }
+
+    /**
+     * @brief The end of the pipe the supervisor waits on.
+     */
+    int readEnd() const noexcept
+    {
+        return pipe_[0];
+    }
+
+    /**
+     * @brief The destination of the output, which the supervisor waits on while it is full.
+     */
+    int target() const noexcept
+    {
+        return target_;
+    }
+
+    /**
+     * @brief Closes the write end once the command has been forked, so that the pipe is closed when it exits.
+     */
+    void closeWriteEnd() noexcept
+    {
+        close(pipe_[1]);
+        pipe_[1] = -1;
+    }
+
+    /**
+     * @brief Moves the pending output to its destination, without blocking on the pipe or the destination.
+     *
+     * @return One of Drained.
+     */
+    int drain() noexcept
+    {
+        while (!done_)
+        {
+            // The output read earlier goes first, the destination may only have taken part of it.
+            if (buffered_ > 0)
+            {
+                if (flush() < 0)
+                {
+                    if (errno == EAGAIN)
+                    {
+                        return BLOCKED;
+                    }
+                    else if (errno != EINTR)
+                    {
+                        // Keep emptying the pipe if the destination fails, so that the command is not blocked.
+                        discard();
+                    }
+                }
+                continue;
+            }
+
+            // Never move anything past the limit.
+            long long length = BUFFER_SIZE;
+            if (limit_ > 0 && limit_ - size_ < length)
+            {
+                length = limit_ - size_;
+            }
+            bool spliced = length > 0 && comparator_ == nullptr && !failed_ && !socket_ && !copying_;
+            ssize_t n;
+            if (length == 0)
+            {
+                // At the limit, one more byte is read, and never forwarded, to tell whether the command exceeds it.
+                char extra;
+                n = read(pipe_[0], &extra, 1);
+                if (n < 0 && errno == EAGAIN)
+                {
+                    return EMPTY;
+                }
+            }
+            else if (spliced)
+            {
+                n = splice(pipe_[0], nullptr, target_, nullptr, length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n < 0 && errno == EINVAL)
+                {
+                    // The destination does not support splice, e.g. a file opened with O_APPEND.
+                    copying_ = true;
+                    continue;
+                }
+                if (n < 0 && errno == EAGAIN)
+                {
+                    // Either side may be the one which would block.
+                    int queued = 0;
+                    return ioctl(pipe_[0], FIONREAD, &queued) == 0 && queued > 0 ? BLOCKED : EMPTY;
+                }
+            }
+            else
+            {
+                n = read(pipe_[0], buffer_.get(), length);
+                if (n > 0 && comparator_ != nullptr && !mismatched_)
+                {
+                    mismatched_ = !comparator_->feed(buffer_.get(), n);
+                }
+                if (n > 0 && !failed_)
+                {
+                    offset_ = 0;
+                    buffered_ = n;
+                }
+                else if (n > 0)
+                {
+                    discarded_ += n;
+                }
+                if (n < 0 && errno == EAGAIN)
+                {
+                    return EMPTY;
+                }
+            }
+
+            if (n > 0)
+            {
+                size_ += n;
+                if (limit_ > 0 && size_ > limit_)
+                {
+                    done_ = exceeded_ = true;
+                }
+            }
+            else if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if (n < 0 && spliced)
+            {
+                failed_ = true;
+            }
+            else
+            {
+                done_ = true;
+            }
+        }
+        return exceeded_ ? EXCEEDED : CLOSED;
+    }
+
+    /**
+     * @brief Drops the output read but not written, and every output after it, e.g. once the destination stopped
+     * taking it for too long.
+     */
+    void discard() noexcept
+    {
+        failed_ = true;
+        discarded_ += buffered_;
+        buffered_ = 0;
+    }
+
+    /**
+     * @brief The size of the output which did not reach the destination in bytes.
+     */
+    long long discarded() const noexcept
+    {
+        return discarded_;
+    }
+
+    /**
+     * @brief The size of the output so far in bytes.
+     */
+    long long size() const noexcept
+    {
+        return size_;
+    }
+
+  private:
+    // Writes as much of the buffered output as the destination takes without blocking.
+    int flush() noexcept
+    {
+        auto data = buffer_.get() + offset_;
+        auto n = socket_ ? send(target_, data, buffered_, MSG_DONTWAIT | MSG_NOSIGNAL) : write(target_, data, buffered_);
+        if (n < 0)
+        {
+            return -1;
+        }
+        offset_ += n;
+        buffered_ -= n;
+        return 0;
+    }
+
+    int pipe_[2] = {-1, -1};
+    int target_ = -1;
+    bool socket_ = false;
+    std::unique_ptr<char[]> buffer_;
+    size_t offset_ = 0;
+    size_t buffered_ = 0;
+    std::unique_ptr<OutputComparator> comparator_;
+    bool mismatched_ = false;
+    long long limit_ = 0;
+    long long size_ = 0;
+    bool done_ = false;
+    bool failed_ = false;
+    bool copying_ = false;
+    bool exceeded_ = false;
+    long long discarded_ = 0;
+};
+} // namespace bsdbx
+
+#endif // CAPTURE_H
@@ -0,0 +1,515 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <atomic>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace bsdbx
+{
+
+/**
+ * @brief Writes a string to a file, typically a cgroup control file.
+ *
+ * @return Returns 0 on success, or -1 on failure with errno set.
+ */
+inline int writeFile(const std::string &path, const std::string &content) noexcept
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    auto n = write(fd, content.data(), content.size());
+    int error = errno;
+    close(fd);
+    errno = error;
+    return n == (ssize_t)content.size() ? 0 : -1;
+}
+
+/**
+ * @brief Reads a small file, typically a cgroup control file, into a string.
+ *
+ * @return Returns 0 on success, or -1 on failure with errno set.
+ */
+inline int readFile(const std::string &path, std::string &content) noexcept
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    content.clear();
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        content.append(buffer, n);
+    }
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Looks up a key in a flat-keyed cgroup file such as memory.events.
+ *
+ * @return The value of the key, or -1 if the key is not present.
+ */
+inline long long readKey(const std::string &content, const std::string &key) noexcept
+{
+    size_t pos = 0;
+    while (pos < content.size())
+    {
+        auto end = content.find('\n', pos);
+        if (end == std::string::npos)
+        {
+            end = content.size();
+        }
+        if (content.compare(pos, key.size(), key) == 0 && pos + key.size() < end && content[pos + key.size()] == ' ')
+        {
+            return atoll(content.c_str() + pos + key.size() + 1);
+        }
+        pos = end + 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief Sums the values of a key over the lines of a nested-keyed cgroup file such as io.stat.
+ *
+ * @return The sum of the values, 0 if the key is not present.
+ */
+inline long long sumKey(const std::string &content, const std::string &key) noexcept
+{
+    long long sum = 0;
+    auto field = " " + key + "=";
+    for (auto pos = content.find(field); pos != std::string::npos; pos = content.find(field, pos + 1))
+    {
+        sum += atoll(content.c_str() + pos + field.size());
+    }
+    return sum;
+}
+
+/**
+ * @brief A cgroup v2 created for a single sandbox run.
+ *
+ * The cgroup is created as a child of a delegated cgroup, i.e. a cgroup in which the sandbox is allowed to create
+ * sub-cgroups and to enable the memory controller. The kernel enforces the memory limit of the run through
+ * memory.max and memory.swap.max, while memory.peak and memory.events give the exact peak usage and the number of
+ * OOM kills without any sampling. Every process forked by the command stays in the cgroup, so these figures, like
+ * the CPU time of cpu.stat, cover the whole process tree. With the pids controller, pids.max caps the number of
+ * tasks of the tree, so that a fork bomb fails with EAGAIN instead of exhausting the host. With the io controller,
+ * io.stat gives the storage I/O of the tree, writeback included, and io.max throttles it on every disk of the host so
+ * that a run streaming to disk does not slow its neighbours down. The whole tree is killed at once through
+ * cgroup.kill, and the cgroup is killed and removed when the object is destroyed.
+ *
+ * Instead of creating a cgroup per run, a run can claim one of a fixed pool of slots, cgroups which are kept across
+ * runs and reset instead of removed, see claim(). The counters of a slot are then read relative to their values when
+ * it was claimed.
+ */
+class Cgroup
+{
+  public:
+    Cgroup() = default;
+    Cgroup(const Cgroup &) = delete;
+    Cgroup &operator=(const Cgroup &) = delete;
+
+    ~Cgroup()
+    {
+        destroy();
+    }
+
+    /**
+     * @brief Creates the cgroup of a run under a delegated parent cgroup.
+     *
+     * @param parent The path of the delegated cgroup, e.g. /sys/fs/cgroup/bsdbx.
+     * @param name The name of the new cgroup, which must be unique among the concurrent runs.
+     * @param memoryLimit The memory limit in KB, 0 for unlimited.
+     * @param taskLimit The maximum number of tasks, 0 for unlimited.
+     * @param ioBandwidthLimit The maximum read and write bandwidth on every disk in KB/s, 0 for unlimited.
+     * @param ioOpsLimit The maximum read and write operations per second on every disk, 0 for unlimited.
+     * @return Returns 0 on success, or -1 if the cgroup cannot be created, lacks the memory controller, or lacks the
+     * pids or io controller while a task or I/O limit is given.
+     */
+    int create(const std::string &parent, const std::string &name, int memoryLimit, int taskLimit = 0,
+               int ioBandwidthLimit = 0, int ioOpsLimit = 0) noexcept
+    {
+        // Enabling a controller fails harmlessly if it is already enabled, one at a time since some may be missing.
+        writeFile(parent + "/cgroup.subtree_control", "+memory");
+        writeFile(parent + "/cgroup.subtree_control", "+pids");
+        writeFile(parent + "/cgroup.subtree_control", "+io");
+
+        auto path = parent + "/" + name;
+        if (mkdir(path.c_str(), 0755) < 0)
+        {
+            return -1;
+        }
+        path_ = path;
+        procs_ = path + "/cgroup.procs";
+
+        auto max = memoryLimit > 0 ? std::to_string(memoryLimit * 1024LL) : std::string("max");
+        if (writeFile(path_ + "/memory.max", max) < 0)
+        {
+            destroy();
+            return -1;
+        }
+        // Swap accounting may be disabled, in which case there is nothing to limit.
+        writeFile(path_ + "/memory.swap.max", "0");
+        if (limitTasks(taskLimit) < 0 || limitIo(ioBandwidthLimit, ioOpsLimit) < 0)
+        {
+            destroy();
+            return -1;
+        }
+        hasPeak_ = access((path_ + "/memory.peak").c_str(), R_OK) == 0;
+        return 0;
+    }
+
+    /**
+     * @brief Claims a free slot of a pool under a delegated parent cgroup, waiting for one if they are all in use.
+     *
+     * The slots are named slot-0 to slot-<slots - 1> and created when first claimed. A slot is held through an
+     * exclusive flock on its directory, so that it is released even if the sandbox dies, and any process left in it
+     * is killed before it is reused. This also caps the number of concurrent runs of every sandbox sharing the pool.
+     *
+     * @param parent The path of the delegated cgroup.
+     * @param slots The number of slots of the pool.
+     * @param memoryLimit The memory limit in KB, 0 for unlimited.
+     * @param taskLimit The maximum number of tasks, 0 for unlimited.
+     * @param ioBandwidthLimit The maximum read and write bandwidth on every disk in KB/s, 0 for unlimited.
+     * @param ioOpsLimit The maximum read and write operations per second on every disk, 0 for unlimited.
+     * @return Returns 0 on success, or -1 if no slot can be claimed or set up.
+     */
+    int claim(const std::string &parent, int slots, int memoryLimit, int taskLimit = 0, int ioBandwidthLimit = 0,
+              int ioOpsLimit = 0) noexcept
+    {
+        writeFile(parent + "/cgroup.subtree_control", "+memory");
+        writeFile(parent + "/cgroup.subtree_control", "+pids");
+        writeFile(parent + "/cgroup.subtree_control", "+io");
+
+        // Try every slot without waiting, then wait for the first one tried.
+        static std::atomic<unsigned> runs{0};
+        unsigned first = runs++;
+        for (int i = 0; i <= slots && lock_ < 0; i++)
+        {
+            auto path = parent + "/slot-" + std::to_string((first + i) % slots);
+            if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST)
+            {
+                return -1;
+            }
+            int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                return -1;
+            }
+            if (flock(fd, i < slots ? LOCK_EX | LOCK_NB : LOCK_EX) < 0)
+            {
+                close(fd);
+                continue;
+            }
+            lock_ = fd;
+            path_ = path;
+        }
+        if (lock_ < 0)
+        {
+            return -1;
+        }
+        procs_ = path_ + "/cgroup.procs";
+        empty();
+
+        auto max = memoryLimit > 0 ? std::to_string(memoryLimit * 1024LL) : std::string("max");
+        if (writeFile(path_ + "/memory.max", max) < 0)
+        {
+            destroy();
+            return -1;
+        }
+        writeFile(path_ + "/memory.swap.max", "0");
+        if (limitTasks(taskLimit) < 0 || limitIo(ioBandwidthLimit, ioOpsLimit) < 0)
+        {
+            destroy();
+            return -1;
+        }
+        // Writing to memory.peak (Linux 6.12+) resets the peak seen through the same descriptor, older kernels only
+        // have the peak of every run so far and the memory is sampled instead.
+        peak_ = open((path_ + "/memory.peak").c_str(), O_RDWR | O_CLOEXEC);
+        if (peak_ >= 0 && write(peak_, "reset", 5) != 5)
+        {
+            close(peak_);
+            peak_ = -1;
+        }
+        hasPeak_ = peak_ >= 0;
+        baseOomKills_ = baseCpuTime_ = baseUserTime_ = baseSystemTime_ = 0;
+        baseReadBytes_ = baseWriteBytes_ = baseReadOps_ = baseWriteOps_ = 0;
+        auto kills = oomKills();
+        long long user = 0, system = 0;
+        auto cpuTime = cpuUsage(user, system);
+        baseOomKills_ = kills > 0 ? kills : 0;
+        baseCpuTime_ = cpuTime > 0 ? cpuTime : 0;
+        baseUserTime_ = user;
+        baseSystemTime_ = system;
+        long long readBytes = 0, writeBytes = 0, readOps = 0, writeOps = 0;
+        if (ioUsage(readBytes, writeBytes, readOps, writeOps) == 0)
+        {
+            baseReadBytes_ = readBytes;
+            baseWriteBytes_ = writeBytes;
+            baseReadOps_ = readOps;
+            baseWriteOps_ = writeOps;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Moves the calling process into the cgroup.
+     *
+     * This is called by the child between fork and execve, so that every page of the sandboxed program is charged.
+     *
+     * @return Returns 0 on success, or -1 on failure.
+     */
+    int enter() const noexcept
+    {
+        // Only async-signal-safe calls, the sandbox may fork from several threads.
+        int fd = open(procs_.c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        auto n = write(fd, "0", 1);
+        close(fd);
+        return n == 1 ? 0 : -1;
+    }
+
+    /**
+     * @brief Whether the kernel records the peak memory usage of the cgroup (memory.peak, Linux 5.19+).
+     */
+    bool hasPeak() const noexcept
+    {
+        return hasPeak_;
+    }
+
+    /**
+     * @brief Reads the peak memory usage of the cgroup.
+     *
+     * @return The peak memory usage in KB, or -1 if it is not available.
+     */
+    long peakMemory() const noexcept
+    {
+        if (peak_ >= 0)
+        {
+            char buffer[32];
+            auto n = pread(peak_, buffer, sizeof(buffer) - 1, 0);
+            buffer[n > 0 ? n : 0] = '\0';
+            return n > 0 ? atoll(buffer) / 1024 : -1;
+        }
+        std::string content;
+        if (!hasPeak_ || readFile(path_ + "/memory.peak", content) < 0)
+        {
+            return -1;
+        }
+        return atoll(content.c_str()) / 1024;
+    }
+
+    /**
+     * @brief Reads the current memory usage of the cgroup, for kernels without memory.peak.
+     *
+     * @return The memory usage in KB, or -1 if it cannot be read.
+     */
+    long currentMemory() const noexcept
+    {
+        std::string content;
+        if (readFile(path_ + "/memory.current", content) < 0)
+        {
+            return -1;
+        }
+        return atoll(content.c_str()) / 1024;
+    }
+
+    /**
+     * @brief Reads the CPU time used by every process which ever ran in the cgroup.
+     *
+     * cpu.stat always reports the usage, even if the cpu controller is not enabled.
+     *
+     * @param userTime Receives the user CPU time in microseconds, unless it cannot be read.
+     * @param systemTime Receives the system CPU time in microseconds, unless it cannot be read.
+     * @return The total CPU time in microseconds, or -1 if it cannot be read.
+     */
+    long long cpuUsage(long long &userTime, long long &systemTime) const noexcept
+    {
+        std::string content;
+        if (readFile(path_ + "/cpu.stat", content) < 0)
+        {
+            return -1;
+        }
+        auto total = readKey(content, "usage_usec");
+        auto user = readKey(content, "user_usec");
+        auto system = readKey(content, "system_usec");
+        if (total >= 0 && user >= 0 && system >= 0)
+        {
+            userTime = user - baseUserTime_;
+            systemTime = system - baseSystemTime_;
+        }
+        return total < 0 ? -1 : total - baseCpuTime_;
+    }
+
+    /**
+     * @brief Reads the storage I/O of every process which ever ran in the cgroup, summed over the devices.
+     *
+     * io.stat charges the writeback of dirty pages to the cgroup which dirtied them, so buffered writes are counted
+     * even if they reach the disk after the command exited, as long as they are flushed before it is read.
+     *
+     * @param readBytes Receives the bytes read from the devices.
+     * @param writeBytes Receives the bytes written to the devices.
+     * @param readOps Receives the read operations issued to the devices.
+     * @param writeOps Receives the write operations issued to the devices.
+     * @return Returns 0 on success, or -1 if io.stat cannot be read, e.g. without the io controller.
+     */
+    int ioUsage(long long &readBytes, long long &writeBytes, long long &readOps, long long &writeOps) const noexcept
+    {
+        std::string content;
+        if (readFile(path_ + "/io.stat", content) < 0)
+        {
+            return -1;
+        }
+        readBytes = sumKey(content, "rbytes") - baseReadBytes_;
+        writeBytes = sumKey(content, "wbytes") - baseWriteBytes_;
+        readOps = sumKey(content, "rios") - baseReadOps_;
+        writeOps = sumKey(content, "wios") - baseWriteOps_;
+        return 0;
+    }
+
+    /**
+     * @brief Reads the number of processes of the cgroup killed by the OOM killer.
+     *
+     * @return The number of OOM kills, or -1 if it is not available.
+     */
+    long long oomKills() const noexcept
+    {
+        std::string content;
+        if (readFile(path_ + "/memory.events", content) < 0)
+        {
+            return -1;
+        }
+        auto kills = readKey(content, "oom_kill");
+        return kills < 0 ? -1 : kills - baseOomKills_;
+    }
+
+    /**
+     * @brief Kills every process of the cgroup at once, without waiting for them to exit.
+     *
+     * @return Returns 0 on success, or -1 on failure, e.g. before Linux 5.14.
+     */
+    int kill() const noexcept
+    {
+        return writeFile(path_ + "/cgroup.kill", "1");
+    }
+
+    /**
+     * @brief Kills every process left in the cgroup and removes it, or releases it if it is a slot.
+     */
+    void destroy() noexcept
+    {
+        if (path_.empty())
+        {
+            return;
+        }
+        if (lock_ >= 0)
+        {
+            empty();
+            if (peak_ >= 0)
+            {
+                close(peak_);
+                peak_ = -1;
+            }
+            close(lock_);
+            lock_ = -1;
+            path_.clear();
+            return;
+        }
+        kill();
+        // The killed processes leave the cgroup asynchronously.
+        for (int i = 0; i < 1000 && rmdir(path_.c_str()) < 0 && errno == EBUSY; i++)
+        {
+            timespec spec{0, 100000};
+            nanosleep(&spec, nullptr);
+        }
+        path_.clear();
+    }
+
+  private:
+    // Sets pids.max, which a slot keeps from its previous run. Without the pids controller only no limit is possible.
+    int limitTasks(int taskLimit) const noexcept
+    {
+        if (writeFile(path_ + "/pids.max", taskLimit > 0 ? std::to_string(taskLimit) : std::string("max")) == 0)
+        {
+            return 0;
+        }
+        return taskLimit > 0 ? -1 : 0;
+    }
+
+    // Sets io.max on every disk of the host, which a slot keeps from its previous run. Devices which cannot be
+    // throttled are skipped, and without the io controller only no limit is possible.
+    int limitIo(int bandwidthLimit, int opsLimit) const noexcept
+    {
+        bool limited = bandwidthLimit > 0 || opsLimit > 0;
+        if (!limited && lock_ < 0)
+        {
+            return 0;
+        }
+        auto bandwidth = bandwidthLimit > 0 ? std::to_string(bandwidthLimit * 1024LL) : std::string("max");
+        auto ops = opsLimit > 0 ? std::to_string(opsLimit) : std::string("max");
+        auto limits = " rbps=" + bandwidth + " wbps=" + bandwidth + " riops=" + ops + " wiops=" + ops;
+        int throttled = 0;
+        DIR *disks = opendir("/sys/block");
+        for (dirent *entry; disks != nullptr && (entry = readdir(disks)) != nullptr;)
+        {
+            std::string device;
+            if (entry->d_name[0] != '.' &&
+                readFile(std::string("/sys/block/") + entry->d_name + "/dev", device) == 0 &&
+                writeFile(path_ + "/io.max", device.substr(0, device.find('\n')) + limits) == 0)
+            {
+                throttled++;
+            }
+        }
+        if (disks != nullptr)
+        {
+            closedir(disks);
+        }
+        return limited && throttled == 0 ? -1 : 0;
+    }
+
+    // Kills every process of the cgroup and waits until they are gone.
+    void empty() const noexcept
+    {
+        std::string events;
+        kill();
+        for (int i = 0; i < 1000 && readFile(path_ + "/cgroup.events", events) == 0 && readKey(events, "populated") > 0;
+             i++)
+        {
+            timespec spec{0, 100000};
+            nanosleep(&spec, nullptr);
+        }
+    }
+
+    std::string path_;
+    std::string procs_;
+    bool hasPeak_ = false;
+    int lock_ = -1;                   // The locked directory of the slot, or -1 if the cgroup is not a slot
+    int peak_ = -1;                   // memory.peak of the slot, reset when it was claimed
+    long long baseOomKills_ = 0;      // The counters of the slot when it was claimed
+    long long baseCpuTime_ = 0;
+    long long baseUserTime_ = 0;
+    long long baseSystemTime_ = 0;
+    long long baseReadBytes_ = 0;
+    long long baseWriteBytes_ = 0;
+    long long baseReadOps_ = 0;
+    long long baseWriteOps_ = 0;
+};
+} // namespace bsdbx
+
+#endif // CGROUP_H
@@ -0,0 +1,426 @@
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include "options.h"
+#include <fcntl.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace bsdbx
+{
+
+/**
+ * @brief The scanning kernels of the comparator, picked once for the CPU: AVX2 if available, SSE2 otherwise on
+ * x86-64, and plain loops elsewhere.
+ *
+ * Whitespace is ' ' and '\t' to '\r', like isspace() in the C locale.
+ */
+struct ScanKernels
+{
+    size_t (*mismatch)(const char *a, const char *b, size_t n); // Index of the first difference, or n
+    size_t (*findSpace)(const char *p, size_t n);               // Index of the first whitespace, or n
+    size_t (*skipSpace)(const char *p, size_t n);               // Index of the first non-whitespace, or n
+};
+
+inline bool isSpace(char c) noexcept
+{
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+inline size_t mismatchScalar(const char *a, const char *b, size_t n) noexcept
+{
+    size_t i = 0;
+    while (i < n && a[i] == b[i])
+    {
+        i++;
+    }
+    return i;
+}
+
+inline size_t findSpaceScalar(const char *p, size_t n) noexcept
+{
+    size_t i = 0;
+    while (i < n && !isSpace(p[i]))
+    {
+        i++;
+    }
+    return i;
+}
+
+inline size_t skipSpaceScalar(const char *p, size_t n) noexcept
+{
+    size_t i = 0;
+    while (i < n && isSpace(p[i]))
+    {
+        i++;
+    }
+    return i;
+}
+
+#if defined(__x86_64__)
+inline size_t mismatchSse2(const char *a, const char *b, size_t n) noexcept
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        auto x = _mm_loadu_si128((const __m128i *)(a + i));
+        auto y = _mm_loadu_si128((const __m128i *)(b + i));
+        unsigned mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffff;
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + mismatchScalar(a + i, b + i, n - i);
+}
+
+inline unsigned spaceMaskSse2(const char *p) noexcept
+{
+    auto v = _mm_loadu_si128((const __m128i *)p);
+    auto space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    auto control = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    control = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8('\r' - '\t')), control);
+    return _mm_movemask_epi8(_mm_or_si128(space, control));
+}
+
+inline size_t findSpaceSse2(const char *p, size_t n) noexcept
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        unsigned mask = spaceMaskSse2(p + i);
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + findSpaceScalar(p + i, n - i);
+}
+
+inline size_t skipSpaceSse2(const char *p, size_t n) noexcept
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        unsigned mask = ~spaceMaskSse2(p + i) & 0xffff;
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + skipSpaceScalar(p + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline size_t mismatchAvx2(const char *a, const char *b, size_t n) noexcept
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        auto x = _mm256_loadu_si256((const __m256i *)(a + i));
+        auto y = _mm256_loadu_si256((const __m256i *)(b + i));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + mismatchSse2(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline unsigned spaceMaskAvx2(const char *p) noexcept
+{
+    auto v = _mm256_loadu_si256((const __m256i *)p);
+    auto space = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    auto control = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    control = _mm256_cmpeq_epi8(_mm256_min_epu8(control, _mm256_set1_epi8('\r' - '\t')), control);
+    return _mm256_movemask_epi8(_mm256_or_si256(space, control));
+}
+
+__attribute__((target("avx2"))) inline size_t findSpaceAvx2(const char *p, size_t n) noexcept
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        unsigned mask = spaceMaskAvx2(p + i);
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + findSpaceSse2(p + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline size_t skipSpaceAvx2(const char *p, size_t n) noexcept
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        unsigned mask = ~spaceMaskAvx2(p + i);
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + skipSpaceSse2(p + i, n - i);
+}
+#endif
+
+/**
+ * @brief Returns the scanning kernels for the CPU.
+ */
+inline const ScanKernels &scanKernels() noexcept
+{
+#if defined(__x86_64__)
+    static const ScanKernels kernels = __builtin_cpu_supports("avx2")
+                                           ? ScanKernels{mismatchAvx2, findSpaceAvx2, skipSpaceAvx2}
+                                           : ScanKernels{mismatchSse2, findSpaceSse2, skipSpaceSse2};
+#else
+    static const ScanKernels kernels{mismatchScalar, findSpaceScalar, skipSpaceScalar};
+#endif
+    return kernels;
+}
+
+/**
+ * @brief Compares an output against the expected output as it is produced.
+ *
+ * The expected output is mapped in memory, and the output is fed in chunks of any size as the command writes it, so
+ * the comparison is over shortly after the command exits, and a mismatch is found as soon as it is written.
+ *
+ * In the token mode, both outputs are split into tokens separated by whitespace, and the tokens must be equal. In the
+ * float mode, two tokens which are not equal are also accepted if both are numbers whose absolute or relative
+ * difference is within the tolerance. In the exact mode, the outputs must be equal byte for byte.
+ */
+class OutputComparator
+{
+  public:
+    /**
+     * @brief The outcome of a comparison.
+     */
+    enum Result
+    {
+        MATCH,     // The outputs are equal
+        MISMATCH,  // The output differs from the expected output, or goes on after it
+        TRUNCATED, // The output is a strict prefix of the expected output, which may be due to a crash
+    };
+
+    OutputComparator() = default;
+    OutputComparator(const OutputComparator &) = delete;
+    OutputComparator &operator=(const OutputComparator &) = delete;
+
+    ~OutputComparator()
+    {
+        if (expected_ != nullptr && size_ > 0)
+        {
+            munmap((void *)expected_, size_);
+        }
+    }
+
+    /**
+     * @brief Maps the expected output.
+     *
+     * @return Returns 0 on success, or -1 on failure.
+     */
+    int open(const std::string &path, CompareMode mode, double tolerance) noexcept
+    {
+        mode_ = mode;
+        tolerance_ = tolerance;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat stat;
+        if (fd < 0 || fstat(fd, &stat) < 0)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return -1;
+        }
+        size_ = stat.st_size;
+        auto map = size_ > 0 ? mmap(nullptr, size_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0) : nullptr;
+        close(fd);
+        if (map == MAP_FAILED)
+        {
+            return -1;
+        }
+        expected_ = size_ > 0 ? (const char *)map : "";
+        return 0;
+    }
+
+    /**
+     * @brief Compares the next chunk of the output.
+     *
+     * @return Returns false once a mismatch is found, after which the rest of the output is ignored.
+     */
+    bool feed(const char *data, size_t n) noexcept
+    {
+        if (mismatch_)
+        {
+            return false;
+        }
+        if (mode_ == CompareMode::EXACT)
+        {
+            auto length = n < size_ - position_ ? n : size_ - position_;
+            mismatch_ = length < n || scanKernels().mismatch(data, expected_ + position_, length) < length;
+            position_ += length;
+        }
+        else
+        {
+            feedTokens(data, n);
+        }
+        return !mismatch_;
+    }
+
+    /**
+     * @brief Ends the comparison once the whole output has been fed.
+     */
+    Result finish() noexcept
+    {
+        auto &kernels = scanKernels();
+        if (!mismatch_ && mode_ != CompareMode::EXACT && inToken_)
+        {
+            inToken_ = false;
+            if (mode_ == CompareMode::FLOAT)
+            {
+                mismatch_ = !matchToken();
+            }
+            else if (position_ < size_ && !isSpace(expected_[position_]))
+            {
+                return TRUNCATED;
+            }
+        }
+        if (mismatch_)
+        {
+            return MISMATCH;
+        }
+        if (mode_ != CompareMode::EXACT)
+        {
+            position_ += kernels.skipSpace(expected_ + position_, size_ - position_);
+        }
+        return position_ == size_ ? MATCH : TRUNCATED;
+    }
+
+  private:
+    static constexpr size_t MAX_NUMBER = 64; // The maximum length of a number in the float mode
+
+    void feedTokens(const char *data, size_t n) noexcept
+    {
+        auto &kernels = scanKernels();
+        size_t i = 0;
+        while (i < n && !mismatch_)
+        {
+            if (!inToken_)
+            {
+                i += kernels.skipSpace(data + i, n - i);
+                if (i == n)
+                {
+                    break;
+                }
+                inToken_ = true;
+                token_.clear();
+                if (mode_ == CompareMode::TOKEN)
+                {
+                    position_ += kernels.skipSpace(expected_ + position_, size_ - position_);
+                }
+            }
+
+            // The part of the token in this chunk, which may go on in the next one.
+            auto length = kernels.findSpace(data + i, n - i);
+            if (mode_ == CompareMode::TOKEN)
+            {
+                // The expected bytes cannot hold whitespace if they are equal to a part of a token.
+                mismatch_ = length > size_ - position_ ||
+                            kernels.mismatch(data + i, expected_ + position_, length) < length;
+                position_ += length;
+            }
+            else
+            {
+                try
+                {
+                    token_.append(data + i, length);
+                }
+                catch (...)
+                {
+                    mismatch_ = true;
+                }
+                // Neither an expected token nor a number is that long.
+                mismatch_ = mismatch_ || (token_.size() > size_ - position_ && token_.size() >= MAX_NUMBER);
+            }
+            i += length;
+
+            if (i < n && !mismatch_)
+            {
+                inToken_ = false;
+                if (mode_ == CompareMode::TOKEN)
+                {
+                    mismatch_ = position_ < size_ && !isSpace(expected_[position_]);
+                }
+                else
+                {
+                    mismatch_ = !matchToken();
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Compares the buffered token against the next expected token, in the float mode.
+     */
+    bool matchToken() noexcept
+    {
+        auto &kernels = scanKernels();
+        position_ += kernels.skipSpace(expected_ + position_, size_ - position_);
+        auto length = kernels.findSpace(expected_ + position_, size_ - position_);
+        auto expected = expected_ + position_;
+        position_ += length;
+        if (length == 0)
+        {
+            return false;
+        }
+        if (length == token_.size() && kernels.mismatch(token_.data(), expected, length) == length)
+        {
+            return true;
+        }
+
+        double actual, wanted;
+        if (!parseNumber(token_.data(), token_.size(), actual) || !parseNumber(expected, length, wanted))
+        {
+            return false;
+        }
+        auto difference = fabs(actual - wanted);
+        return difference <= tolerance_ || difference <= tolerance_ * fabs(wanted);
+    }
+
+    static bool parseNumber(const char *token, size_t length, double &value) noexcept
+    {
+        char buffer[MAX_NUMBER];
+        if (length >= sizeof(buffer))
+        {
+            return false;
+        }
+        memcpy(buffer, token, length);
+        buffer[length] = '\0';
+        char *end;
+        value = strtod(buffer, &end);
+        return end == buffer + length && !isnan(value);
+    }
+
+    CompareMode mode_ = CompareMode::TOKEN;
+    double tolerance_ = 0;
+    const char *expected_ = nullptr;
+    size_t size_ = 0;
+    size_t position_ = 0;
+    bool inToken_ = false;
+    bool mismatch_ = false;
+    std::string token_;
+};
+} // namespace bsdbx
+
+#endif // COMPARE_H
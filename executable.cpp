@@ -1,280 +1,171 @@
-#include "monitor.h"
-#include "rule.h"
+#include "batch.h"
+#include "cache.h"
+#include "capture.h"
+#include "filter.h"
+#include "interact.h"
+#include "options.h"
+#include "profile.h"
+#include "repeat.h"
+#include "result.h"
+#include "run.h"
+#include "server.h"
+#include "timing.h"
 #include <exception>
-#include <future>
+#include <fcntl.h>
 #include <iostream>
 #include <stdexcept>
+#include <string.h>
 #include <string>
-#include <string_view>
-#include <sys/resource.h>
 #include <unistd.h>
 #include <vector>
 
 // Memory limit in KB
-// Time limit in miliseconds
+// Time limits in miliseconds
 
 int main(int argc, char **argv, char **envp)
 {
-    // Process the args manually
-    bool mode = 0;
-    int removeArgNum = 0;
-    int findMode = 0;
-    int findTimeLimit = 0;
-    int timeLimit = 0;
-    int memoryLimit = 0;
-    int findMemoryLimit = 0;
+    bsdbx::PhaseTimer timer;
 
-    // Fetch the mode.
-    for (size_t i = 0; i < argc; i++)
-    {
-        std::string_view str(argv[i]);
-        if (str == "--mode")
-        {
-            findMode = 2;
-            if (i >= argc - 1)
-            {
-                throw std::invalid_argument("Missing argument for sandbox mode");
-            }
-            i++;
-            std::string_view m(argv[i]);
-            if (m == "compiler")
-            {
-                mode = 1;
-            }
-            else if (m == "runner")
-            {
-                mode = 0;
-            }
-            else
-            {
-                std::string ex = "Invalid mode: ";
-                ex += m;
-                throw std::invalid_argument(ex);
-            }
-            break;
-        }
-        else if (str.substr(0, 7) == "--mode=")
-        {
-            findMode = 1;
-            if (str.substr(7) == "compiler")
-            {
-                mode = 1;
-            }
-            else if (str.substr(7) == "runner")
-            {
-                mode = 0;
-            }
-            else
-            {
-                std::string ex = "Invalid mode: ";
-                ex += str.substr(7);
-                throw std::invalid_argument(ex);
-            }
-            break;
-            ;
-        }
-        else if (str == "-m")
-        {
-            findMode = 2;
-            if (i >= argc - 1)
-            {
-                throw std::invalid_argument("Missing argument for sandbox mode");
-            }
-            i++;
-            std::string_view m(argv[i]);
-            if (m == "compiler")
-            {
-                mode = 1;
-            }
-            else if (m == "runner")
-            {
-                mode = 0;
-            }
-            else
-            {
-                std::string ex = "Invalid mode: ";
-                ex += m;
-                throw std::invalid_argument(ex);
-            }
-            break;
-        }
-    }
+    // Process the args
+    auto options = bsdbx::parseOptions(argc, argv);
+    auto args = options.args.data();
+    timer.lap("parse");
 
-    // Fetch the time limit.
-    for (size_t i = 0; i < argc; i++)
+    // Fill the filter cache at deploy time.
+    if (!options.warmCache.empty())
     {
-        std::string_view str(argv[i]);
-        if (str == "--time-limit")
-        {
-            findTimeLimit = 2;
-            if (i >= argc - 1)
-            {
-                throw std::invalid_argument("Missing argument for sandbox mode");
-            }
-            i++;
-            std::string_view m(argv[i]);
-            int t = std::stoi(m.data());
-            timeLimit = t;
-            break;
-        }
-        else if (str.substr(0, 13) == "--time-limit=")
+        if (bsdbx::warmFilterCache(options.warmCache) < 0)
         {
-            findTimeLimit = 1;
-            auto s = str.substr(13);
-            int t = std::stoi(s.data());
-            timeLimit = t;
-            break;
-        }
-        else if (str == "-t")
-        {
-            findTimeLimit = 2;
-            if (i >= argc - 1)
-            {
-                throw std::invalid_argument("Missing argument for sandbox mode");
-            }
-            i++;
-            std::string_view m(argv[i]);
-            int t = std::stoi(m.data());
-            timeLimit = t;
-            break;
+            throw std::runtime_error("Failed to fill the seccomp filter cache");
         }
+        return 0;
     }
 
-    // Fetch the memory limit.
-    for (size_t i = 0; i < argc; i++)
+    // Statistics which are asked for but cannot be published are an error, not an empty monitor.
+    if (options.liveStats && bsdbx::LiveStats::instance().error() != 0)
     {
-        std::string_view str(argv[i]);
-        if (str == "--memory-limit")
-        {
-            findMemoryLimit = 2;
-            if (i >= argc - 1)
-            {
-                throw std::invalid_argument("Missing argument for sandbox mode");
-            }
-            i++;
-            std::string_view m(argv[i]);
-            int t = std::stoi(m.data());
-            memoryLimit = t;
-            break;
-        }
-        else if (str.substr(0, 15) == "--memory-limit=")
-        {
-            findMemoryLimit = 1;
-            auto s = str.substr(15);
-            int t = std::stoi(s.data());
-            memoryLimit = t;
-            break;
-        }
+        throw std::runtime_error("Failed to publish the live statistics: " +
+                                 std::string(strerror(bsdbx::LiveStats::instance().error())));
     }
 
-    // Test whether there possibly exists an executable path.
-    if (argc - findMode - findTimeLimit <= 1)
+    // Serve jobs until killed.
+    if (!options.serve.empty())
     {
-        throw std::invalid_argument("No executable file");
+        bsdbx::serve(options, envp);
+        return 0;
     }
 
-    // Copy args.
-    auto args = new char *[argc]();
-    for (size_t i = 0, flag = 0, moFlag = 0, memFlag = 0, tFlag = 0;
-         i < argc - 1 - findMode - findTimeLimit - findMemoryLimit; i++)
+    // Compile the security mode before the run, or map it from the cache.
+    bsdbx::Filter filter;
+    const char *executable;
+    if (bsdbx::prepareFilter(filter, options.mode, options.filterCache, args[0], executable) < 0)
     {
-        std::string_view str = argv[i + 1 + flag];
-        if (!moFlag && (str == "-m" || str == "--mode" || str.substr(0, 7) == "--mode="))
-        {
-            flag += findMode;
-            moFlag = 1;
-            str = argv[i + 1 + flag];
-        }
-        if (!tFlag && (str == "-t" || str == "--time-limit" || str.substr(0, 13) == "--time-limit="))
-        {
-            flag += findTimeLimit;
-            tFlag = 1;
-            str = argv[i + 1 + flag];
-        }
-        if (!memFlag && (str == "--memory-limit" || str.substr(0, 15) == "--memory-limit="))
-        {
-            flag += findMemoryLimit;
-            memFlag = 1;
-            str = argv[i + 1 + flag];
-        }
-        if (i < argc - 1 - findMode - findTimeLimit - findMemoryLimit)
-        {
-            args[i] = argv[i + 1 + flag];
-        }
+        throw std::runtime_error("Failed to prepare the seccomp filter");
     }
+    timer.lap("rules");
 
-    // Load security mode.
-    if (mode)
+    // Run every test case of a manifest with the same filter.
+    if (!options.batch.empty())
     {
-        bsdbx::loadCompilerRule();
+        return bsdbx::runBatch(options, filter, executable, envp);
     }
-    else
-    {
-        bsdbx::loadRunnerRule(args[0]);
-    }
-
-    auto pid = fork();
 
-    if (pid == 0)
+    // The command must not see where its result goes.
+    int resultFd = options.resultFd;
+    if (resultFd >= 0 && fcntl(resultFd, F_SETFD, FD_CLOEXEC) < 0)
     {
-        // bsdbx::loadBanFork();
-        execve(args[0], args, envp);
+        throw std::invalid_argument("Invalid result file descriptor");
     }
-    else if (pid > 0)
+    if (!options.resultFile.empty())
     {
-        std::future<int> futureMemory, futureTime;
-        if (memoryLimit)
-        {
-            futureMemory = std::async(std::launch::async, bsdbx::monitorMemoryUsage, memoryLimit, pid);
-        }
-        else
+        resultFd = open(options.resultFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (resultFd < 0)
         {
-            futureMemory = std::async(std::launch::async, bsdbx::monitorMemoryUsage, 1 << 30, pid);
+            throw std::runtime_error("Failed to open the result file");
         }
+    }
 
-        if (timeLimit)
+    // Run the solution against its interactor, each with its own filter.
+    if (!options.interactor.empty())
+    {
+        std::vector<std::string> words;
+        auto interactor = bsdbx::interactorOptions(options, words);
+        bsdbx::Filter interactorFilter;
+        const char *interactorExecutable;
+        if (bsdbx::prepareFilter(interactorFilter, interactor.mode, interactor.filterCache, interactor.args[0],
+                                 interactorExecutable) < 0)
         {
-            futureTime = std::async(std::launch::async, bsdbx::monitorTime, timeLimit, pid);
+            throw std::runtime_error("Failed to prepare the seccomp filter of the interactor");
         }
-        else
+        auto result =
+            bsdbx::interact(options, filter, executable, interactor, interactorFilter, interactorExecutable, envp);
+        bsdbx::printUsage(std::cerr, result.solution);
+        bsdbx::printUsage(std::cerr, result.interactor);
+        if (resultFd >= 0 && bsdbx::writeResult(resultFd, result.solution, nullptr, &result.interactor) < 0)
         {
-            futureTime = std::async(std::launch::async, bsdbx::monitorTime, 1e9, pid);
+            throw std::runtime_error("Failed to write the result");
         }
+        return bsdbx::exitCode(result.solution);
+    }
 
-        int status = 0;
-        waitpid(pid, &status, 0);
-        int memory = futureMemory.get();
-        int time = futureTime.get();
-
-        if (memory != -1)
+    // Measure the command over repeated runs, to calibrate the limits.
+    if (options.repeat > 0)
+    {
+        auto usages = bsdbx::runRepeated(options, filter, executable, envp);
+        bsdbx::printRepetitions(std::cerr, usages);
+        if (resultFd >= 0 && bsdbx::writeString(resultFd, bsdbx::formatRepetitions(usages)) < 0)
         {
-            std::cerr << memory << std::endl;
+            throw std::runtime_error("Failed to write the result");
         }
-        else
+        for (auto &usage : usages)
         {
-            std::cerr << "MLE" << std::endl;
+            if (std::string(bsdbx::verdict(usage)) != "OK")
+            {
+                return -1;
+            }
         }
+        return 0;
+    }
 
-        if (time != -1)
+    // The input is sealed in memory, so that it cannot change during the run.
+    int stdio[3] = {-1, -1, -1};
+    if (!options.stdinFile.empty())
+    {
+        int input = bsdbx::sealInput(options.stdinFile);
+        stdio[0] = input < 0 ? -1 : bsdbx::openInput(input);
+        if (stdio[0] < 0)
         {
-            std::cerr << time << std::endl;
+            throw std::runtime_error("Failed to open the input file");
         }
-        else
+        close(input);
+    }
+    if (!options.stdoutFile.empty())
+    {
+        stdio[1] = open(options.stdoutFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (stdio[1] < 0)
         {
-            std::cerr << "TLE" << std::endl;
+            throw std::runtime_error("Failed to open the output file");
         }
+    }
 
-        if (time == -1 || memory == -1)
-        {
-            return -1;
-        }
-        else
-        {
-            return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
-        }
+    bsdbx::SyscallProfiler profiler;
+    auto profile = options.profileSyscalls ? &profiler : nullptr;
+    auto phases = options.phaseTiming ? &timer : nullptr;
+    auto usage = options.mode && !options.compileCache.empty()
+                     ? bsdbx::runCompile(options, filter, executable, envp, stdio, phases, profile)
+                     : bsdbx::run(options, filter, executable, envp, stdio, phases, profile);
+    bsdbx::printUsage(std::cerr, usage);
+    if (profile != nullptr)
+    {
+        profiler.print(std::cerr);
+    }
+    if (resultFd >= 0 && bsdbx::writeResult(resultFd, usage, profile) < 0)
+    {
+        throw std::runtime_error("Failed to write the result");
     }
-    else
+    if (options.phaseTiming)
     {
-        throw std::runtime_error("Failed to fork");
+        timer.print(std::cerr);
     }
+    return bsdbx::exitCode(usage);
 }
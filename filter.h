@@ -0,0 +1,492 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "landlock.h"
+#include "rule.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace bsdbx
+{
+
+/**
+ * @brief Exports the BPF program generated by libseccomp for a filter context.
+ *
+ * @param context The filter context.
+ * @param program Receives the instructions of the program.
+ * @return Returns 0 on success, or a negative error code on failure.
+ */
+inline int exportRule(scmp_filter_ctx context, std::vector<sock_filter> &program) noexcept
+{
+    int fd = memfd_create("bsdbx-bpf", MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+    int result = seccomp_export_bpf(context, fd);
+    auto size = lseek(fd, 0, SEEK_END);
+    if (result < 0 || size <= 0 || size % sizeof(sock_filter) != 0)
+    {
+        close(fd);
+        return result < 0 ? result : -EINVAL;
+    }
+    program.resize(size / sizeof(sock_filter));
+    auto n = pread(fd, program.data(), size, 0);
+    close(fd);
+    return n == size ? 0 : -EIO;
+}
+
+/**
+ * @brief The header of a cached filter file, followed by the instructions of every program in installation order.
+ */
+struct FilterCacheHeader
+{
+    static constexpr char MAGIC[8] = {'B', 'S', 'D', 'B', 'X', 'B', 'P', 'F'};
+    static constexpr uint32_t VERSION = 4; // Has to be bumped whenever the rules in rule.h change
+    static constexpr uint32_t MAX_PROGRAMS = 4;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t count;                  // Number of programs
+    uint64_t execAddress;            // Address of the executable name compared by the runner execve rule
+    uint32_t lengths[MAX_PROGRAMS];  // Number of instructions of each program
+    uint32_t landlock;               // Whether the programs rely on Landlock to restrict the writes
+};
+
+/**
+ * @brief The compiled seccomp filters of a sandbox mode, ready to be installed without libseccomp.
+ *
+ * The programs are either generated through libseccomp or mapped from a cache file written by a previous run. A cached
+ * filter is only valid for the architecture and the libseccomp version it was generated with, which are part of the
+ * name of the cache file.
+ *
+ * The runner rule compares the address of the executable name passed to execve. To make the program reusable, the
+ * name is copied to a fixed address chosen at random when the program is generated, see pinExecutable(). A command
+ * which learns the address can map it and execve anything, so the cache must stay out of reach of the commands: its
+ * files are private to the user of the sandbox, and spawn() hides the cache directory from the command with Landlock.
+ */
+class Filter
+{
+  public:
+    Filter() = default;
+    Filter(const Filter &) = delete;
+    Filter &operator=(const Filter &) = delete;
+
+    ~Filter()
+    {
+        reset();
+    }
+
+    /**
+     * @brief Generates the filters of a mode through libseccomp.
+     *
+     * @param mode 0 for the runner mode and 1 for the compiler mode.
+     * @param execAddress The address the name of the executable is pinned to, only used in the runner mode.
+     * @param landlock Whether the command is restricted by a LandlockPolicy, see buildRunnerRule().
+     * @return Returns 0 on success, or a negative error code on failure.
+     */
+    int build(bool mode, uint64_t execAddress, bool landlock = false) noexcept
+    {
+        reset();
+        execAddress_ = execAddress;
+        landlock_ = landlock;
+        scmp_filter_ctx context;
+        int result = mode ? buildCompilerRule(context)
+                          : buildRunnerRule((const char *)(uintptr_t)execAddress, context, landlock);
+        if (result < 0)
+        {
+            return result;
+        }
+        owned_.resize(1);
+        result = exportRule(context, owned_[0]);
+        seccomp_release(context);
+        if (result < 0)
+        {
+            reset();
+            return result;
+        }
+        programs_.push_back({(unsigned short)owned_[0].size(), owned_[0].data()});
+        return 0;
+    }
+
+    /**
+     * @brief Maps the filters from a cache file.
+     *
+     * @param path The path of the cache file.
+     * @return Returns 0 on success, or -1 if the file does not exist, is not a valid cache file, or is not private to
+     * the user of the sandbox.
+     */
+    int load(const std::string &path) noexcept
+    {
+        reset();
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        // A file anyone else could have read or written may leak or forge the pinned address.
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(FilterCacheHeader) || st.st_uid != geteuid() ||
+            (st.st_mode & 077) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+        map_ = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map_ == MAP_FAILED)
+        {
+            return -1;
+        }
+        mapLength_ = st.st_size;
+
+        auto header = (const FilterCacheHeader *)map_;
+        if (memcmp(header->magic, FilterCacheHeader::MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != FilterCacheHeader::VERSION || header->count == 0 ||
+            header->count > FilterCacheHeader::MAX_PROGRAMS)
+        {
+            reset();
+            return -1;
+        }
+        size_t offset = sizeof(FilterCacheHeader);
+        for (uint32_t i = 0; i < header->count; i++)
+        {
+            auto length = header->lengths[i];
+            if (length == 0 || length > BPF_MAXINSNS || offset + length * sizeof(sock_filter) > mapLength_)
+            {
+                reset();
+                return -1;
+            }
+            programs_.push_back({(unsigned short)length, (sock_filter *)((char *)map_ + offset)});
+            offset += length * sizeof(sock_filter);
+        }
+        if (offset != mapLength_)
+        {
+            reset();
+            return -1;
+        }
+        execAddress_ = header->execAddress;
+        landlock_ = header->landlock != 0;
+        return 0;
+    }
+
+    /**
+     * @brief Atomically writes the filters to a cache file, so that concurrent runs never see a partial file.
+     *
+     * The file is only accessible to the user of the sandbox, as created by mkstemp().
+     *
+     * @param path The path of the cache file.
+     * @return Returns 0 on success, or -1 on failure.
+     */
+    int save(const std::string &path) const noexcept
+    {
+        FilterCacheHeader header{};
+        memcpy(header.magic, FilterCacheHeader::MAGIC, sizeof(header.magic));
+        header.version = FilterCacheHeader::VERSION;
+        header.count = programs_.size();
+        header.execAddress = execAddress_;
+        header.landlock = landlock_;
+        for (size_t i = 0; i < programs_.size() && i < FilterCacheHeader::MAX_PROGRAMS; i++)
+        {
+            header.lengths[i] = programs_[i].len;
+        }
+
+        auto temporary = path + ".XXXXXX";
+        int fd = mkstemp(temporary.data());
+        if (fd < 0)
+        {
+            return -1;
+        }
+        bool ok = write(fd, &header, sizeof(header)) == sizeof(header);
+        for (auto &program : programs_)
+        {
+            auto size = program.len * sizeof(sock_filter);
+            ok = ok && write(fd, program.filter, size) == (ssize_t)size;
+        }
+        close(fd);
+        if (!ok || rename(temporary.c_str(), path.c_str()) < 0)
+        {
+            unlink(temporary.c_str());
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Installs the filters into the calling process with the seccomp system call.
+     *
+     * @return Returns 0 on success, or a negative error code on failure.
+     */
+    int install() const noexcept
+    {
+        if (programs_.empty())
+        {
+            return -EINVAL;
+        }
+        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0)
+        {
+            return -errno;
+        }
+        for (auto &program : programs_)
+        {
+            if (syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, &program) < 0)
+            {
+                return -errno;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * @brief The address the runner rule expects the name of the executable at.
+     */
+    uint64_t execAddress() const noexcept
+    {
+        return execAddress_;
+    }
+
+    /**
+     * @brief Whether the filters rely on a LandlockPolicy to restrict the writes of the command.
+     */
+    bool landlock() const noexcept
+    {
+        return landlock_;
+    }
+
+  private:
+    void reset() noexcept
+    {
+        if (map_ != MAP_FAILED)
+        {
+            munmap(map_, mapLength_);
+            map_ = MAP_FAILED;
+        }
+        owned_.clear();
+        programs_.clear();
+        execAddress_ = 0;
+        landlock_ = false;
+    }
+
+    std::vector<std::vector<sock_filter>> owned_;
+    std::vector<sock_fprog> programs_;
+    void *map_ = MAP_FAILED;
+    size_t mapLength_ = 0;
+    uint64_t execAddress_ = 0;
+    bool landlock_ = false;
+};
+
+/**
+ * @brief Creates a cache directory private to the user of the sandbox, or checks that an existing one is.
+ *
+ * @param directory The path of the directory.
+ * @return Returns 0 if the directory is owned by the effective user and neither group- nor world-accessible, or -1
+ * with errno set otherwise.
+ */
+inline int privateDirectory(const std::string &directory) noexcept
+{
+    if (mkdir(directory.c_str(), 0700) < 0 && errno != EEXIST)
+    {
+        return -1;
+    }
+    struct stat st;
+    if (stat(directory.c_str(), &st) < 0)
+    {
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077) != 0)
+    {
+        errno = EACCES;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the path of the cache file of a mode for the native architecture and libseccomp version.
+ */
+inline std::string filterCachePath(const std::string &directory, bool mode)
+{
+    auto version = seccomp_version();
+    char name[128];
+    snprintf(name, sizeof(name), "/%s-%08x-%u.%u.%u.bpf", mode ? "compiler" : "runner", seccomp_arch_native(),
+             version->major, version->minor, version->micro);
+    return directory + name;
+}
+
+/**
+ * @brief Chooses a random page address to pin the name of the executable to.
+ *
+ * The address is taken from a range the kernel does not hand out by default, so that it hardly ever collides with
+ * the mappings of the sandbox.
+ */
+inline uint64_t randomExecAddress() noexcept
+{
+    static const uint64_t PAGE = sysconf(_SC_PAGESIZE);
+    uint64_t random = 0;
+    if (getrandom(&random, sizeof(random), 0) != sizeof(random))
+    {
+        random = (uint64_t)time(nullptr) * 0x9e3779b97f4a7c15ULL ^ getpid();
+    }
+    uint64_t low = sizeof(void *) == 8 ? 1ULL << 32 : 0x10000000ULL;
+    uint64_t high = sizeof(void *) == 8 ? 1ULL << 38 : 0x40000000ULL;
+    return (low + random % (high - low)) / PAGE * PAGE;
+}
+
+/**
+ * @brief Copies the name of the executable to a fixed address.
+ *
+ * The mapping is inherited by the child, which passes the returned pointer to execve. It is large enough for any path,
+ * so that a long-lived sandbox can copy the names of later executables to the same address.
+ *
+ * @param path The name of the executable.
+ * @param address The page address to copy the name to.
+ * @return The pinned copy of the name, or nullptr if the address is not available.
+ */
+inline const char *pinExecutable(const char *path, uint64_t address) noexcept
+{
+    static const size_t PAGE = sysconf(_SC_PAGESIZE);
+    auto size = strlen(path) + 1 > PATH_MAX ? strlen(path) + 1 : PATH_MAX;
+    auto length = (size + PAGE - 1) / PAGE * PAGE;
+    auto map = mmap((void *)(uintptr_t)address, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    if (map != (void *)(uintptr_t)address)
+    {
+        munmap(map, length);
+        return nullptr;
+    }
+    strcpy((char *)map, path);
+    return (const char *)map;
+}
+
+/**
+ * @brief Unmaps a name pinned by pinExecutable(), once the command has been forked.
+ *
+ * This frees the address for the next run of a long-lived process, so that it can keep using a cached filter.
+ */
+inline void unpinExecutable(const char *pinned) noexcept
+{
+    static const size_t PAGE = sysconf(_SC_PAGESIZE);
+    auto size = strlen(pinned) + 1 > PATH_MAX ? strlen(pinned) + 1 : PATH_MAX;
+    munmap((void *)pinned, (size + PAGE - 1) / PAGE * PAGE);
+}
+
+/**
+ * @brief Prepares the filters of a run, preferring the cached programs over generating them.
+ *
+ * The filters rely on Landlock whenever the kernel supports it, in which case spawn() restricts the command with a
+ * LandlockPolicy. A cached program generated for the other case is regenerated. Without Landlock the cache could not
+ * be hidden from the command, so it is not used.
+ *
+ * @param filter Receives the filters.
+ * @param mode 0 for the runner mode and 1 for the compiler mode.
+ * @param cacheDirectory The directory of the filter cache, empty to disable the cache.
+ * @param path The name of the executable.
+ * @param pinned Receives the name of the executable to pass to execve.
+ * @return Returns 0 on success, or a negative error code on failure, e.g. -EACCES if the cache directory is not
+ * private to the user of the sandbox.
+ */
+inline int prepareFilter(Filter &filter, bool mode, const std::string &cacheDirectory, const char *path,
+                         const char *&pinned) noexcept
+{
+    pinned = path;
+    bool landlock = landlockAbi() > 0;
+    std::string cachePath = cacheDirectory.empty() || !landlock ? "" : filterCachePath(cacheDirectory, mode);
+    if (!cachePath.empty() && privateDirectory(cacheDirectory) < 0)
+    {
+        return -errno;
+    }
+    if (!cachePath.empty() && filter.load(cachePath) == 0 && filter.landlock() == landlock)
+    {
+        if (mode)
+        {
+            return 0;
+        }
+        auto copy = pinExecutable(path, filter.execAddress());
+        if (copy != nullptr)
+        {
+            pinned = copy;
+            return 0;
+        }
+        // The cached address is taken in this process, generate a program for another one.
+        cachePath.clear();
+    }
+
+    uint64_t address = 0;
+    if (!mode)
+    {
+        const char *copy = nullptr;
+        for (int i = 0; i < 16 && copy == nullptr; i++)
+        {
+            address = randomExecAddress();
+            copy = pinExecutable(path, address);
+        }
+        if (copy == nullptr)
+        {
+            return -ENOMEM;
+        }
+        pinned = copy;
+    }
+    int result = filter.build(mode, address, landlock);
+    if (result == 0 && !cachePath.empty())
+    {
+        // A failure to fill the cache only costs the next run the generation.
+        filter.save(cachePath);
+    }
+    return result;
+}
+
+/**
+ * @brief Fills the filter cache with the programs of every mode, e.g. when deploying the sandbox.
+ *
+ * @param cacheDirectory The directory of the filter cache.
+ * @return Returns 0 on success, or a negative error code on failure, e.g. -ENOSYS if the kernel has no Landlock and
+ * the cache would not be used.
+ */
+inline int warmFilterCache(const std::string &cacheDirectory) noexcept
+{
+    if (landlockAbi() == 0)
+    {
+        return -ENOSYS;
+    }
+    if (privateDirectory(cacheDirectory) < 0)
+    {
+        return -errno;
+    }
+    for (bool mode : {false, true})
+    {
+        Filter filter;
+        int result = filter.build(mode, mode ? 0 : randomExecAddress(), landlockAbi() > 0);
+        if (result < 0)
+        {
+            return result;
+        }
+        if (filter.save(filterCachePath(cacheDirectory, mode)) < 0)
+        {
+            return -EIO;
+        }
+    }
+    return 0;
+}
+} // namespace bsdbx
+
+#endif // FILTER_H
@@ -0,0 +1,219 @@
+#ifndef INTERACT_H
+#define INTERACT_H
+
+#include "filter.h"
+#include "monitor.h"
+#include "options.h"
+#include "run.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace bsdbx
+{
+
+/**
+ * @brief The outcome of an interactive run.
+ */
+struct Interaction
+{
+    Usage solution{};   // The resource usage of the solution, with the verdict of the interactor folded in
+    Usage interactor{}; // The resource usage of the interactor
+};
+
+/**
+ * @brief Builds the options of the interactor of a run from options.interactor.
+ *
+ * The interactor runs under options.interactorMode with the time limits of the solution, since both run together,
+ * but without a memory limit, and may read and write the default paths of its mode.
+ *
+ * @param options The options of the run.
+ * @param words Receives the words of the command line of the interactor, which the arguments point into.
+ * @return The options of the interactor.
+ * @throw std::invalid_argument If the command line of the interactor is empty.
+ */
+inline Options interactorOptions(const Options &options, std::vector<std::string> &words)
+{
+    std::istringstream stream(options.interactor);
+    for (std::string word; stream >> word;)
+    {
+        words.push_back(word);
+    }
+    if (words.empty())
+    {
+        throw std::invalid_argument("No interactor executable");
+    }
+    Options interactor;
+    interactor.mode = options.interactorMode;
+    interactor.timeLimit = options.timeLimit;
+    interactor.cpuTimeLimit = options.cpuTimeLimit;
+    interactor.taskLimit = options.taskLimit;
+    interactor.sampleInterval = options.sampleInterval;
+    interactor.cgroup = options.cgroup;
+    interactor.slots = options.slots;
+    interactor.filterCache = options.filterCache;
+    for (auto &word : words)
+    {
+        interactor.args.push_back(word.data());
+    }
+    interactor.args.push_back(nullptr);
+    return interactor;
+}
+
+/**
+ * @brief Runs a solution against its interactor, each under its own profile, and supervises both together.
+ *
+ * The standard output of each is connected to the standard input of the other by a pipe, and both are supervised by
+ * a single event loop, each with its own limits. As soon as the interactor exits, its verdict is known: if it
+ * rejected the solution, the solution is killed instead of waiting for it to notice. The output of the solution is
+ * not captured, the interactor checks it.
+ *
+ * The verdict of the interactor is folded into the usage of the solution: answer is 1 if the interactor exited with
+ * 0 and 0 otherwise, wrongAnswer is set if it rejected a solution which neither exceeded its limits nor failed on its
+ * own, and judgeFailed if the interactor exceeded its limits or was killed by a signal. A solution killed by
+ * SIGPIPE only lost its interactor, so it did not fail on its own. With options.liveStats, the run is published once
+ * with the verdict of the solution.
+ *
+ * @param options The options of the solution.
+ * @param filter The prepared filter of the solution.
+ * @param executable The name of the executable of the solution, as returned by prepareFilter().
+ * @param interactor The options of the interactor, see interactorOptions().
+ * @param interactorFilter The prepared filter of the interactor.
+ * @param interactorExecutable The name of the executable of the interactor, as returned by prepareFilter().
+ * @param envp The environment of both commands.
+ * @return The outcome of the run.
+ * @throw std::runtime_error If the commands cannot be started or the supervisor cannot be set up, in which case
+ * they are killed.
+ */
+inline Interaction interact(const Options &options, const Filter &filter, const char *executable,
+                            const Options &interactor, const Filter &interactorFilter, const char *interactorExecutable,
+                            char **envp)
+{
+    int toInteractor[2], toSolution[2];
+    if (pipe2(toInteractor, O_CLOEXEC) < 0)
+    {
+        throw std::runtime_error("Failed to create a pipe");
+    }
+    if (pipe2(toSolution, O_CLOEXEC) < 0)
+    {
+        close(toInteractor[0]);
+        close(toInteractor[1]);
+        throw std::runtime_error("Failed to create a pipe");
+    }
+    auto closePipes = [&]() {
+        for (int fd : {toInteractor[0], toInteractor[1], toSolution[0], toSolution[1]})
+        {
+            close(fd);
+        }
+    };
+
+    Options solutionOptions = options;
+    solutionOptions.outputLimit = 0;
+    solutionOptions.expectedFile.clear();
+    Process solution, judge;
+    try
+    {
+        int solutionStdio[3] = {toSolution[0], toInteractor[1], -1};
+        solution = spawn(solutionOptions, filter, executable, envp, solutionStdio);
+        int interactorStdio[3] = {toInteractor[0], toSolution[1], -1};
+        judge = spawn(interactor, interactorFilter, interactorExecutable, envp, interactorStdio);
+    }
+    catch (...)
+    {
+        closePipes();
+        if (solution.pid > 0)
+        {
+            if (getpgid(solution.pid) == solution.pid)
+            {
+                kill(-solution.pid, SIGKILL);
+            }
+            kill(solution.pid, SIGKILL);
+            waitpid(solution.pid, nullptr, 0);
+        }
+        throw;
+    }
+    // Each side must see the end of its input once the other side exits.
+    closePipes();
+
+    Interaction result;
+    bool killed = false;
+    auto stats = options.liveStats ? &LiveStats::instance() : nullptr;
+    if (stats != nullptr)
+    {
+        stats->begin();
+    }
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    try
+    {
+        Supervisor solutionSupervisor(solution.pid, solution.start, solutionOptions.timeLimit,
+                                      solutionOptions.cpuTimeLimit, solutionOptions.memoryLimit,
+                                      solutionOptions.sampleInterval, solution.cgroup.get(), nullptr, nullptr,
+                                      solution.timeline.get());
+        Supervisor judgeSupervisor(judge.pid, judge.start, interactor.timeLimit, interactor.cpuTimeLimit,
+                                   interactor.memoryLimit, interactor.sampleInterval, judge.cgroup.get());
+        solutionSupervisor.attach(epfd);
+        judgeSupervisor.attach(epfd);
+        bool judged = false;
+        while (solutionSupervisor.running() || judgeSupervisor.running())
+        {
+            epoll_event events[12];
+            int n = epoll_wait(epfd, events, 12, -1);
+            for (int i = 0; i < n; i++)
+            {
+                solutionSupervisor.handle(events[i].data.fd) || judgeSupervisor.handle(events[i].data.fd);
+            }
+            if (!judged && !judgeSupervisor.running())
+            {
+                judged = true;
+                result.interactor = judgeSupervisor.finish();
+                if (!WIFEXITED(result.interactor.status) || WEXITSTATUS(result.interactor.status) != 0)
+                {
+                    killed = solutionSupervisor.running();
+                    solutionSupervisor.kill();
+                }
+            }
+        }
+        result.solution = solutionSupervisor.finish();
+    }
+    catch (...)
+    {
+        if (epfd >= 0)
+        {
+            close(epfd);
+        }
+        if (stats != nullptr)
+        {
+            stats->cancel();
+        }
+        throw;
+    }
+    close(epfd);
+    if (solution.timeline != nullptr)
+    {
+        solution.timeline->write();
+    }
+
+    auto &usage = result.solution;
+    auto &judgement = result.interactor;
+    bool exceeded = usage.timeExceeded || usage.cpuTimeExceeded || usage.memoryExceeded;
+    bool crashed = WIFSIGNALED(usage.status) ? WTERMSIG(usage.status) != SIGPIPE && !killed
+                                             : WEXITSTATUS(usage.status) != 0;
+    usage.judgeFailed = !exceeded && (judgement.timeExceeded || judgement.cpuTimeExceeded ||
+                                      judgement.memoryExceeded || !WIFEXITED(judgement.status));
+    usage.answer = WIFEXITED(judgement.status) && WEXITSTATUS(judgement.status) == 0;
+    usage.wrongAnswer = !exceeded && !crashed && !usage.judgeFailed && usage.answer == 0;
+    if (stats != nullptr)
+    {
+        publishRun(*stats, usage);
+    }
+    return result;
+}
+} // namespace bsdbx
+
+#endif // INTERACT_H
@@ -0,0 +1,295 @@
+#ifndef LANDLOCK_H
+#define LANDLOCK_H
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/landlock.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+// Access rights newer than some kernel headers.
+#ifndef LANDLOCK_ACCESS_FS_TRUNCATE
+#define LANDLOCK_ACCESS_FS_TRUNCATE (1ULL << 14)
+#endif
+#ifndef LANDLOCK_ACCESS_FS_IOCTL_DEV
+#define LANDLOCK_ACCESS_FS_IOCTL_DEV (1ULL << 15)
+#endif
+
+namespace bsdbx
+{
+
+/**
+ * @brief Returns the Landlock ABI version of the running kernel, or 0 if Landlock is not available.
+ */
+inline int landlockAbi() noexcept
+{
+    static const int abi = [] {
+        long version = syscall(SYS_landlock_create_ruleset, nullptr, 0, LANDLOCK_CREATE_RULESET_VERSION);
+        return version > 0 ? (int)version : 0;
+    }();
+    return abi;
+}
+
+/**
+ * @brief Splits a colon-separated list of paths, like PATH.
+ */
+inline std::vector<std::string> splitPaths(const std::string &list)
+{
+    std::vector<std::string> paths;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        auto end = list.find(':', start);
+        if (end == std::string::npos)
+        {
+            end = list.size();
+        }
+        if (end > start)
+        {
+            paths.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return paths;
+}
+
+/**
+ * @brief Returns whether a resolved path is a directory or lies beneath it.
+ */
+inline bool isBeneath(std::string_view path, std::string_view directory) noexcept
+{
+    return path.substr(0, directory.size()) == directory &&
+           (path.size() == directory.size() || directory == "/" || path[directory.size()] == '/');
+}
+
+/**
+ * @brief Resolves a path like realpath(), returning an empty string if it does not exist.
+ */
+inline std::string resolvePath(const std::string &path)
+{
+    char real[PATH_MAX];
+    return realpath(path.c_str(), real) != nullptr ? real : "";
+}
+
+/**
+ * @brief Returns whether an existing directory lies beneath, or is, one of a list of paths.
+ */
+inline bool isBeneathAny(const std::string &directory, const std::vector<std::string> &paths)
+{
+    auto resolved = resolvePath(directory);
+    for (auto &path : paths)
+    {
+        auto base = resolvePath(path);
+        if (!resolved.empty() && !base.empty() && isBeneath(resolved, base))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief The default paths a mode may read and write, used when none are given.
+ *
+ * Both modes may read everything. The runner may only write to /dev/null, besides the files it inherits, while the
+ * compiler may also write to its working directory and /tmp.
+ */
+inline void defaultPaths(bool mode, std::vector<std::string> &readable, std::vector<std::string> &writable)
+{
+    readable = {"/"};
+    writable = mode ? std::vector<std::string>{"/dev/null", "/tmp", "."} : std::vector<std::string>{"/dev/null"};
+}
+
+/**
+ * @brief A filesystem policy enforced by Landlock, which restricts the files the command may open by path.
+ *
+ * The ruleset is built by the supervisor before the fork, and the child only has to restrict itself to it before
+ * loading the seccomp filter. Files which are already open, e.g. the standard input and output, are not affected.
+ * Every access right the kernel knows of is handled, so anything outside the lists is denied with EACCES instead of
+ * killing the command.
+ *
+ * Landlock can only grant, so a hidden directory beneath an allowed one, e.g. a cache beneath "/", is carved out by
+ * granting the entries of each directory on the way to it one by one. Those directories themselves may only be
+ * listed, and their entries created after the ruleset are not accessible.
+ */
+class LandlockPolicy
+{
+  public:
+    LandlockPolicy() = default;
+    LandlockPolicy(const LandlockPolicy &) = delete;
+    LandlockPolicy &operator=(const LandlockPolicy &) = delete;
+
+    ~LandlockPolicy()
+    {
+        if (ruleset_ >= 0)
+        {
+            close(ruleset_);
+        }
+    }
+
+    /**
+     * @brief Builds the ruleset.
+     *
+     * Paths which do not exist are skipped.
+     *
+     * @param readable The files and directories the command may read and execute.
+     * @param writable The files and directories the command may read, write, create and remove files in.
+     * @param hidden The directories the command may not access at all, even beneath an allowed path.
+     * @return Returns 0 on success, or -1 on failure with errno set, e.g. ENOSYS if Landlock is not available.
+     */
+    int create(const std::vector<std::string> &readable, const std::vector<std::string> &writable,
+               const std::vector<std::string> &hidden = {})
+    {
+        int abi = landlockAbi();
+        if (abi == 0)
+        {
+            errno = ENOSYS;
+            return -1;
+        }
+        landlock_ruleset_attr attr{};
+        attr.handled_access_fs = (LANDLOCK_ACCESS_FS_MAKE_SYM << 1) - 1;
+        attr.handled_access_fs |= abi >= 2 ? LANDLOCK_ACCESS_FS_REFER : 0;
+        attr.handled_access_fs |= abi >= 3 ? LANDLOCK_ACCESS_FS_TRUNCATE : 0;
+        attr.handled_access_fs |= abi >= 5 ? LANDLOCK_ACCESS_FS_IOCTL_DEV : 0;
+        ruleset_ = syscall(SYS_landlock_create_ruleset, &attr, sizeof(attr), 0);
+        if (ruleset_ < 0)
+        {
+            return -1;
+        }
+
+        for (auto &path : hidden)
+        {
+            auto resolved = resolvePath(path);
+            if (!resolved.empty())
+            {
+                hidden_.push_back(resolved);
+            }
+        }
+        uint64_t read = LANDLOCK_ACCESS_FS_EXECUTE | LANDLOCK_ACCESS_FS_READ_FILE | LANDLOCK_ACCESS_FS_READ_DIR;
+        for (auto &path : readable)
+        {
+            if (allowVisible(path, read) < 0)
+            {
+                return -1;
+            }
+        }
+        for (auto &path : writable)
+        {
+            if (allowVisible(path, attr.handled_access_fs) < 0)
+            {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Restricts the calling process to the ruleset, if one was built.
+     *
+     * This is called by the child between fork and execve, before the seccomp filter is installed.
+     *
+     * @return Returns 0 on success, or -1 on failure.
+     */
+    int restrict() const noexcept
+    {
+        if (ruleset_ < 0)
+        {
+            return 0;
+        }
+        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0)
+        {
+            return -1;
+        }
+        return syscall(SYS_landlock_restrict_self, ruleset_, 0) < 0 ? -1 : 0;
+    }
+
+  private:
+    int allowVisible(const std::string &path, uint64_t access)
+    {
+        auto resolved = resolvePath(path);
+        if (resolved.empty())
+        {
+            return errno == ENOENT || errno == ENOTDIR ? 0 : -1;
+        }
+        bool ancestor = false;
+        for (auto &directory : hidden_)
+        {
+            if (isBeneath(resolved, directory))
+            {
+                return 0;
+            }
+            ancestor = ancestor || isBeneath(directory, resolved);
+        }
+        if (!ancestor)
+        {
+            return allow(resolved, access);
+        }
+
+        // Listing the directory does not reveal more than the names of the entries beneath it.
+        if (allow(resolved, access & LANDLOCK_ACCESS_FS_READ_DIR) < 0)
+        {
+            return -1;
+        }
+        DIR *dir = opendir(resolved.c_str());
+        if (dir == nullptr)
+        {
+            return -1;
+        }
+        int result = 0;
+        while (auto entry = readdir(dir))
+        {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            {
+                continue;
+            }
+            auto child = (resolved == "/" ? "" : resolved) + "/" + entry->d_name;
+            if (allowVisible(child, access) < 0)
+            {
+                result = -1;
+                break;
+            }
+        }
+        closedir(dir);
+        return result;
+    }
+
+    int allow(const std::string &path, uint64_t access) noexcept
+    {
+        int fd = open(path.c_str(), O_PATH | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return errno == ENOENT || errno == ENOTDIR ? 0 : -1;
+        }
+        struct stat stat;
+        if (fstat(fd, &stat) == 0 && !S_ISDIR(stat.st_mode))
+        {
+            // Only the rights which apply to a file can be granted on one.
+            access &= LANDLOCK_ACCESS_FS_EXECUTE | LANDLOCK_ACCESS_FS_WRITE_FILE | LANDLOCK_ACCESS_FS_READ_FILE |
+                      LANDLOCK_ACCESS_FS_TRUNCATE | LANDLOCK_ACCESS_FS_IOCTL_DEV;
+        }
+        landlock_path_beneath_attr rule{};
+        rule.allowed_access = access;
+        rule.parent_fd = fd;
+        int result = syscall(SYS_landlock_add_rule, ruleset_, LANDLOCK_RULE_PATH_BENEATH, &rule, 0);
+        int error = errno;
+        close(fd);
+        errno = error;
+        return result < 0 ? -1 : 0;
+    }
+
+    int ruleset_ = -1;
+    std::vector<std::string> hidden_;
+};
+} // namespace bsdbx
+
+#endif // LANDLOCK_H
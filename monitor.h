@@ -1,96 +1,1114 @@
 #ifndef MONITOR_H
 #define MONITOR_H
 
+#include "capture.h"
+#include "cgroup.h"
+#include "timeline.h"
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdexcept>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/wait.h>
 #include <time.h>
+#include <unistd.h>
 
 namespace bsdbx
 {
 
 /**
- * @brief Monitors a process for a specified time limit and terminates it if it is still running.
- *
- * This function repeatedly checks if a process with the given PID is still running, up to a specified time limit.
- * If the process is still running after the time limit, it sends a SIGKILL signal to terminate the process.
- *
- * @param timeLimit The maximum amount of time (in miliseconds) to monitor the process.
- * @param pid The process ID of the process to monitor.
- * @param status A reference to an integer where the status of the process will be stored.
- * @return Returns 0 if the process terminates before the time limit, or 1 if the process is terminated by this
- * function.
- * @note This function uses nanosleep to wait for short intervals between checks.
- * @note The function is marked noexcept, indicating it does not throw exceptions.
+ * @brief The resource usage of a supervised process.
  */
-int monitorTime(int timeLimit, int pid) noexcept
+struct Usage
 {
-    for (int i = 0; i < timeLimit; i++)
+    int status = 0;               // The wait status of the process
+    long long time = 0;           // Wall time in microseconds
+    long long userTime = 0;       // User CPU time in microseconds
+    long long systemTime = 0;     // System CPU time in microseconds
+    long memory = 0;              // Peak resident memory of the process tree in KB
+    bool timeExceeded = false;    // Whether the process was killed for exceeding the wall time limit
+    bool cpuTimeExceeded = false; // Whether the process was killed for exceeding the CPU time limit
+    bool memoryExceeded = false;  // Whether the process was killed for exceeding the memory limit
+    long maxResident = 0;         // Peak resident set of the process as reported by the kernel in KB
+    long minorFaults = 0;         // Page faults served without I/O
+    long majorFaults = 0;         // Page faults which required I/O
+    long voluntarySwitches = 0;   // Context switches because the process waited for a resource
+    long involuntarySwitches = 0; // Context switches because the time slice of the process ran out
+    long long readChars = -1;     // Bytes passed to read-like calls, -1 if unknown
+    long long writeChars = -1;    // Bytes passed to write-like calls, -1 if unknown
+    long long readBytes = -1;     // Bytes fetched from the storage layer, -1 if unknown
+    long long writeBytes = -1;    // Bytes sent to the storage layer, -1 if unknown
+    long long readCalls = -1;     // Read-like system calls, -1 if unknown
+    long long writeCalls = -1;    // Write-like system calls, -1 if unknown
+    long long readOps = -1;       // Read operations issued to the storage devices, -1 if unknown
+    long long writeOps = -1;      // Write operations issued to the storage devices, -1 if unknown
+    long long output = -1;        // Size of the captured standard output in bytes, -1 if it was not captured
+    bool outputExceeded = false;  // Whether the process was killed for exceeding the output limit
+    int answer = -1;              // 1 if the output matched the expected output, 0 if not, -1 if it was not judged
+    bool wrongAnswer = false;     // Whether the verdict of the process is a wrong answer
+    bool cached = false;          // Whether the result was taken from the compile cache instead of running the process
+    bool judgeFailed = false;     // Whether the interactor of the process exceeded its limits or was killed
+    long long samples = 0;        // Memory samples taken by the sampling tick
+    long long missedSamples = 0;  // Ticks of the sampling tick which passed while the supervisor was late
+    int untrackedProcesses = 0;   // Descendants which were not sampled because the tree was too large
+    long long outputDropped = 0;  // Bytes of the captured output which never reached the destination
+};
+
+/**
+ * @brief Returns the current value of the monotonic clock in microseconds.
+ */
+inline long long monotonicMicros() noexcept
+{
+    timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000LL + spec.tv_nsec / 1000;
+}
+
+/**
+ * @brief Reads a CPU-time clock in microseconds.
+ *
+ * @return The value of the clock, or -1 if the clock can no longer be read.
+ */
+inline long long cpuClockMicros(clockid_t clock) noexcept
+{
+    timespec spec;
+    if (clock_gettime(clock, &spec) < 0)
+    {
+        return -1;
+    }
+    return spec.tv_sec * 1000000LL + spec.tv_nsec / 1000;
+}
+
+/**
+ * @brief Sets the kernel CPU-time limit of the calling process.
+ *
+ * RLIMIT_CPU only has a granularity of seconds, so the limit is rounded up and the supervisor enforces the exact
+ * limit on its own. The kernel limit is a backstop which also holds if the supervisor is not scheduled: the soft
+ * limit raises SIGXCPU and the hard limit, one second later, raises SIGKILL.
+ *
+ * @param cpuTimeLimit The CPU time limit in miliseconds, 0 for unlimited.
+ * @return Returns 0 on success, or -1 on failure.
+ */
+inline int setCpuTimeLimit(int cpuTimeLimit) noexcept
+{
+    if (cpuTimeLimit <= 0)
+    {
+        return 0;
+    }
+    rlimit limit;
+    limit.rlim_cur = (cpuTimeLimit + 999) / 1000;
+    limit.rlim_max = limit.rlim_cur + 1;
+    return setrlimit(RLIMIT_CPU, &limit);
+}
+
+/**
+ * @brief Reads the resident memory of a process from an open /proc/<pid>/statm file.
+ *
+ * @param statmFd A file descriptor of /proc/<pid>/statm, which is kept open between the samples.
+ * @return The resident memory in KB, or -1 if the file can no longer be read.
+ */
+inline long readResidentMemory(int statmFd) noexcept
+{
+    static const long PAGE_SIZE = sysconf(_SC_PAGESIZE);
+    char buffer[128];
+    auto n = pread(statmFd, buffer, sizeof(buffer) - 1, 0);
+    if (n <= 0)
+    {
+        return -1;
+    }
+    buffer[n] = '\0';
+    long size, resident;
+    if (sscanf(buffer, "%ld %ld", &size, &resident) != 2)
+    {
+        return -1;
+    }
+    return resident * PAGE_SIZE / 1024;
+}
+
+/**
+ * @brief Samples the resident memory and the CPU time of the descendants of a process from /proc.
+ *
+ * The descendants are found through the children files of every thread (CONFIG_PROC_CHILDREN). Walking the tree
+ * costs a few system calls per process, so it is only walked every REFRESH_INTERVAL, while the stat file of every
+ * descendant found is kept open and read on every sample. The CPU time of a process includes the time of the children
+ * it already reaped, so the CPU time of the whole tree is the CPU clock of the root plus the time returned here, even
+ * for processes which lived between two walks. Their memory, and that of orphans adopted by init, is missed: only a
+ * cgroup gives exact figures.
+ *
+ * At most CAPACITY descendants are followed at once. Those found beyond, or whose stat file cannot be opened, are
+ * counted by untracked() so that the result tells the figures are short.
+ */
+class DescendantSampler
+{
+  public:
+    static constexpr int CAPACITY = 256;                  // Descendants followed at once
+    static constexpr long long REFRESH_INTERVAL = 10000; // Interval between two walks of the tree in microseconds
+
+    DescendantSampler() = default;
+    DescendantSampler(const DescendantSampler &) = delete;
+    DescendantSampler &operator=(const DescendantSampler &) = delete;
+
+    ~DescendantSampler()
+    {
+        for (int i = 0; i < count_; i++)
+        {
+            close(stats_[i]);
+        }
+        if (root_ >= 0)
+        {
+            close(root_);
+        }
+    }
+
+    /**
+     * @brief Starts following the tree of a process.
+     *
+     * @param pid The root of the tree.
+     * @return Returns 0 on success, or -1 if the process cannot be read.
+     */
+    int open(int pid) noexcept
+    {
+        pid_ = pid;
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+        root_ = ::open(path, O_RDONLY | O_CLOEXEC);
+        return root_ < 0 ? -1 : 0;
+    }
+
+    /**
+     * @brief Samples the descendants, after walking the tree again if it is due.
+     *
+     * @param memory Receives the resident memory of the descendants in KB.
+     * @param cpuTime Receives the CPU time of the descendants and of the children reaped by the root in microseconds.
+     */
+    void sample(long &memory, long long &cpuTime) noexcept
+    {
+        static const long TICKS = sysconf(_SC_CLK_TCK);
+        static const long PAGE_SIZE = sysconf(_SC_PAGESIZE);
+        auto now = monotonicMicros();
+        if (now >= nextRefresh_)
+        {
+            refresh();
+            nextRefresh_ = now + REFRESH_INTERVAL;
+        }
+
+        memory = 0;
+        cpuTime = 0;
+        long long ticks = 0;
+        long resident;
+        // The time of the root itself is read from its CPU clock, which is more precise.
+        if (readStat(root_, ticks, resident, false))
+        {
+            cpuTime = ticks * 1000000 / TICKS;
+        }
+        for (int i = 0; i < count_;)
+        {
+            if (!readStat(stats_[i], ticks, resident, true))
+            {
+                // The process is gone, its time moves to its parent when it is reaped.
+                close(stats_[i]);
+                count_--;
+                pids_[i] = pids_[count_];
+                stats_[i] = stats_[count_];
+                continue;
+            }
+            cpuTime += ticks * 1000000 / TICKS;
+            memory += resident * PAGE_SIZE / 1024;
+            i++;
+        }
+    }
+
+    /**
+     * @brief Returns the largest number of descendants found by a walk which could not be followed.
+     */
+    int untracked() const noexcept
+    {
+        return untracked_;
+    }
+
+  private:
+    // Reads the CPU time in ticks, with or without that of the process itself, and the resident memory in pages.
+    static bool readStat(int fd, long long &ticks, long &resident, bool self) noexcept
+    {
+        char buffer[1024];
+        auto n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buffer[n] = '\0';
+        // utime, stime, cutime and cstime are the fields 14 to 17 and rss the field 24, after the name which may
+        // contain anything.
+        char *name = strrchr(buffer, ')');
+        unsigned long long user, system;
+        long long childUser, childSystem;
+        if (name == nullptr ||
+            sscanf(name + 1,
+                   " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %lld %lld %*d %*d %*d %*d %*u %*u %ld",
+                   &user, &system, &childUser, &childSystem, &resident) != 5)
+        {
+            return false;
+        }
+        ticks = (self ? user + system : 0) + childUser + childSystem;
+        return true;
+    }
+
+    // Walks the tree, opening the stat file of the new descendants and closing those of the ones which left it.
+    void refresh() noexcept
+    {
+        char path[96];
+        char buffer[4096];
+        int pending[CAPACITY + 1];
+        bool seen[CAPACITY] = {};
+        int size = 0, untracked = 0;
+        pending[size++] = pid_;
+        while (size > 0)
+        {
+            int process = pending[--size];
+            snprintf(path, sizeof(path), "/proc/%d/task", process);
+            DIR *tasks = opendir(path);
+            if (tasks == nullptr)
+            {
+                continue;
+            }
+            for (dirent *entry; (entry = readdir(tasks)) != nullptr;)
+            {
+                if (entry->d_name[0] == '.')
+                {
+                    continue;
+                }
+                snprintf(path, sizeof(path), "/proc/%d/task/%.16s/children", process, entry->d_name);
+                int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+                auto n = fd < 0 ? -1 : ::read(fd, buffer, sizeof(buffer) - 1);
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+                buffer[n > 0 ? n : 0] = '\0';
+                for (char *next = buffer;;)
+                {
+                    char *end;
+                    long child = strtol(next, &end, 10);
+                    if (end == next)
+                    {
+                        break;
+                    }
+                    next = end;
+                    int index = follow(child);
+                    if (index == -2)
+                    {
+                        continue;
+                    }
+                    if (index < 0 || size >= (int)(sizeof(pending) / sizeof(*pending)))
+                    {
+                        untracked++;
+                        continue;
+                    }
+                    seen[index] = true;
+                    pending[size++] = child;
+                }
+            }
+            closedir(tasks);
+        }
+        for (int i = count_ - 1; i >= 0; i--)
+        {
+            if (!seen[i])
+            {
+                close(stats_[i]);
+                count_--;
+                pids_[i] = pids_[count_];
+                stats_[i] = stats_[count_];
+                seen[i] = seen[count_];
+            }
+        }
+        untracked_ = untracked > untracked_ ? untracked : untracked_;
+    }
+
+    // Returns the index of a descendant in the table, adding it if it is new, -2 if it is already gone, or -1 if it
+    // cannot be followed.
+    int follow(int pid) noexcept
+    {
+        for (int i = 0; i < count_; i++)
+        {
+            if (pids_[i] == pid)
+            {
+                return i;
+            }
+        }
+        if (count_ >= CAPACITY)
+        {
+            return -1;
+        }
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return errno == ENOENT || errno == ESRCH ? -2 : -1;
+        }
+        pids_[count_] = pid;
+        stats_[count_] = fd;
+        return count_++;
+    }
+
+    int pid_ = -1;
+    int root_ = -1;
+    int pids_[CAPACITY];
+    int stats_[CAPACITY];
+    int count_ = 0;
+    int untracked_ = 0;
+    long long nextRefresh_ = 0;
+};
+
+/**
+ * @brief Reads the I/O counters of a process from an open /proc/<pid>/io file.
+ *
+ * The file can only be read until the process is reaped, so the supervisor reads it once the process has exited.
+ *
+ * @param ioFd A file descriptor of /proc/<pid>/io.
+ * @param usage Receives the counters, which are left at -1 if the file cannot be read.
+ */
+inline void readIoCounters(int ioFd, Usage &usage) noexcept
+{
+    char buffer[512];
+    auto n = pread(ioFd, buffer, sizeof(buffer) - 1, 0);
+    if (n <= 0)
     {
-        timespec spec;
-        spec.tv_nsec = 1e6 - 20;
-        spec.tv_sec = 0;
-        nanosleep(&spec, nullptr);
-        if (kill(pid, 0) == -1)
+        return;
+    }
+    buffer[n] = '\0';
+    for (char *line = buffer; line != nullptr && *line != '\0';)
+    {
+        char key[32];
+        long long value;
+        if (sscanf(line, "%31[^:]: %lld", key, &value) == 2)
         {
-            return i;
+            std::string_view name = key;
+            if (name == "rchar")
+            {
+                usage.readChars = value;
+            }
+            else if (name == "wchar")
+            {
+                usage.writeChars = value;
+            }
+            else if (name == "read_bytes")
+            {
+                usage.readBytes = value;
+            }
+            else if (name == "write_bytes")
+            {
+                usage.writeBytes = value;
+            }
+            else if (name == "syscr")
+            {
+                usage.readCalls = value;
+            }
+            else if (name == "syscw")
+            {
+                usage.writeCalls = value;
+            }
         }
+        line = strchr(line, '\n');
+        line = line != nullptr ? line + 1 : nullptr;
     }
-    kill(pid, SIGKILL);
-    return -1;
 }
 
 /**
- * @brief Monitors the memory usage of a process and terminates it if it exceeds a specified limit.
+ * @brief Waits until the killed processes of a process group have exited, for at most a timeout.
  *
- * This function continuously checks the memory usage of a process identified by its PID.
- * If the memory usage exceeds the specified limit, the process is terminated.
+ * A group which is already gone costs a single kill(). Otherwise its members are found by scanning /proc and waited
+ * for through their pidfds, which become readable when they exit. Zombies have exited already and are skipped, their
+ * parent or init reaps them.
  *
- * @param memoryLimit The memory limit in kilobytes. If the process exceeds this limit, it will be terminated.
- * @param pid The process ID of the process to monitor.
- * @return The maximum memory usage in kilobytes observed during the monitoring period.
- *         Returns -1 if the process is terminated due to exceeding the memory limit.
+ * @param pgid The ID of the process group.
+ * @param timeout The timeout in miliseconds.
+ */
+inline void waitProcessGroup(int pgid, int timeout) noexcept
+{
+    constexpr int CAPACITY = 256;
+    auto deadline = monotonicMicros() + timeout * 1000LL;
+    while (::kill(-pgid, 0) == 0 && monotonicMicros() < deadline)
+    {
+        pollfd members[CAPACITY];
+        int count = 0;
+        DIR *processes = opendir("/proc");
+        for (dirent *entry; processes != nullptr && count < CAPACITY && (entry = readdir(processes)) != nullptr;)
+        {
+            char path[64], buffer[512];
+            int pid = atoi(entry->d_name);
+            snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+            int fd = pid > 0 ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+            auto n = fd < 0 ? -1 : read(fd, buffer, sizeof(buffer) - 1);
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            buffer[n > 0 ? n : 0] = '\0';
+            // The state and the process group are the fields 3 and 5, after the name which may contain anything.
+            char *name = n > 0 ? strrchr(buffer, ')') : nullptr;
+            char state;
+            int group;
+            if (name == nullptr || sscanf(name + 1, " %c %*d %d", &state, &group) != 2 || group != pgid ||
+                state == 'Z')
+            {
+                continue;
+            }
+            int pidfd = syscall(SYS_pidfd_open, pid, 0);
+            if (pidfd >= 0)
+            {
+                members[count++] = {pidfd, POLLIN, 0};
+            }
+        }
+        if (processes != nullptr)
+        {
+            closedir(processes);
+        }
+        if (count == 0)
+        {
+            return;
+        }
+        for (int left = count; left > 0;)
+        {
+            auto remaining = (deadline - monotonicMicros() + 999) / 1000;
+            int n = remaining > 0 ? poll(members, count, remaining) : 0;
+            if (n <= 0)
+            {
+                break;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                if (members[i].fd >= 0 && members[i].revents != 0)
+                {
+                    close(members[i].fd);
+                    members[i].fd = -1;
+                    left--;
+                }
+            }
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (members[i].fd >= 0)
+            {
+                close(members[i].fd);
+            }
+        }
+        // A full scan may have missed members, the group is scanned again until none is left.
+        if (count < CAPACITY)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Arms a timerfd to expire after the given number of microseconds, optionally periodically.
+ */
+inline int armTimer(int fd, long long micros, bool periodic) noexcept
+{
+    itimerspec spec{};
+    spec.it_value.tv_sec = micros / 1000000;
+    spec.it_value.tv_nsec = micros % 1000000 * 1000;
+    if (periodic)
+    {
+        spec.it_interval = spec.it_value;
+    }
+    return timerfd_settime(fd, 0, &spec, nullptr);
+}
+
+/**
+ * @brief Follows a child process which is traced with ptrace, e.g. the SyscallProfiler.
  *
- * @note This function uses the /proc filesystem to read the memory usage of the process.
- *       It assumes a Linux environment where the /proc filesystem is available.
- * @note The function is marked as noexcept, indicating that it does not throw exceptions.
+ * A traced child reports its stops to the supervisor, which then has to reap it through the tracer instead of the
+ * pidfd. The child stops itself with SIGSTOP before loading the filter, and the supervisor calls attach() as soon as
+ * it listens to SIGCHLD, then poll() every time SIGCHLD is raised.
  */
-int monitorMemoryUsage(int memoryLimit, int pid) noexcept
+class Tracer
 {
-    long PAGE_SIZE = sysconf(_SC_PAGESIZE);
-    int maxMemory = 0;
-    while (kill(pid, 0) == 0)
+  public:
+    virtual ~Tracer() = default;
+
+    /**
+     * @brief Takes over the stopped child and resumes it.
+     *
+     * @return Returns 0 on success, or -1 on failure.
+     */
+    virtual int attach(int pid) noexcept = 0;
+
+    /**
+     * @brief Handles every pending stop of the traced processes.
+     *
+     * @param pid The process ID of the child.
+     * @param ioFd A file descriptor of /proc/<pid>/io, to read into usage before the child is reaped, or -1.
+     * @param usage Receives the wait status and I/O counters of the child.
+     * @param resources Receives the rusage of the child.
+     * @return Whether the child has been reaped.
+     */
+    virtual bool poll(int pid, int ioFd, Usage &usage, rusage &resources) noexcept = 0;
+};
+
+/**
+ * @brief Supervises a child process until it exits, enforcing the time and memory limits.
+ *
+ * The supervisor is driven by an epoll event loop, see supervise(). It watches the pidfd of the child, which becomes
+ * readable when the child exits, a timerfd for the wall-clock deadline, another one for the CPU-time check and a
+ * third one for the memory sampling tick. A process exceeding one of the limits is killed through its pidfd and
+ * reaped like any other process. Several supervisors may share an event loop, e.g. the solution and the interactor
+ * of an interactive problem, see interact().
+ *
+ * Whenever the child is killed, its whole process tree is killed with it: at once through cgroup.kill when it has a
+ * cgroup, or through its process group when it leads one, see spawn(). Once the child exits, whatever it left
+ * running is killed the same way before the next run, and the supervisor waits until a process group is gone.
+ *
+ * The limits apply to the whole process tree of the child, e.g. a compiler driver and the compilers it runs. The
+ * CPU time is read from the CPU clock of the child plus the time of its descendants, see DescendantSampler. Since
+ * a process cannot consume more CPU time than elapsed wall time per thread, the CPU-time check is armed to fire when
+ * the remaining CPU budget could have been used up at the earliest, and re-armed with the new remaining budget until
+ * the child exits or runs out of it. The sampling tick checks the CPU time as well, which bounds the overshoot of
+ * multi-threaded processes and process trees. After the child exits, the user and system times, page faults and
+ * context switches are taken from its rusage, and its I/O counters from /proc/<pid>/io just before it is reaped.
+ *
+ * When the child runs in its own cgroup, the kernel enforces the memory limit and reports the exact peak usage of
+ * the tree, and cpu.stat its exact CPU time, including the processes the child did not wait for. The sampling tick
+ * is then only armed if memory.peak is not available, in which case memory.current is sampled, or to check the CPU
+ * time limit.
+ *
+ * When the standard output of the child is captured, the supervisor moves it to its destination every time the pipe
+ * becomes readable, and kills the child once it exceeds the output limit or differs from the expected output. Output
+ * which is only cut short is not a wrong answer if the child failed, so that a crash is reported as such. Once the
+ * child exited, a destination which stays full past the rest of the wall time limit, or DRAIN_GRACE_PERIOD if that
+ * is longer, loses the output left, which is counted in Usage::outputDropped.
+ *
+ * When a timeline is recorded, a fourth timerfd takes its samples at its own interval until the child exits.
+ *
+ * When the child is traced, SIGCHLD is blocked while supervising and read from a signalfd instead of the pidfd, and
+ * the tracer reaps the child. A traced child must have the event loop to itself.
+ *
+ * A supervisor which is destroyed before the child was reaped kills and reaps it.
+ */
+class Supervisor
+{
+  public:
+    static constexpr int DRAIN_GRACE_PERIOD = 1000; // Least time given to a full destination after the exit in ms
+
+    /**
+     * @param pid The process ID of the child to supervise, which must not be reaped yet.
+     * @param start The value of monotonicMicros() when the child was started.
+     * @param timeLimit The wall time limit in miliseconds, 0 for unlimited.
+     * @param cpuTimeLimit The CPU time limit in miliseconds, 0 for unlimited.
+     * @param memoryLimit The memory limit in KB, 0 for unlimited.
+     * @param sampleInterval The interval between two memory samples in microseconds.
+     * @param cgroup The cgroup of the child, or nullptr if the child is not placed in a cgroup of its own.
+     * @param tracer The tracer of the child, or nullptr if the child is not traced.
+     * @param capture The capture of the standard output of the child, or nullptr if it is not captured.
+     * @param timeline The recorder of the timeline of the child, or nullptr if it is not recorded.
+     */
+    Supervisor(int pid, long long start, int timeLimit, int cpuTimeLimit, int memoryLimit, int sampleInterval,
+               const Cgroup *cgroup = nullptr, Tracer *tracer = nullptr, OutputCapture *capture = nullptr,
+               TimelineRecorder *timeline = nullptr) noexcept
+        : pid_(pid), start_(start), timeLimit_(timeLimit), cpuTimeLimit_(cpuTimeLimit), memoryLimit_(memoryLimit),
+          sampleInterval_(sampleInterval), cgroup_(cgroup), tracer_(tracer), capture_(capture), timeline_(timeline)
     {
-        char path[256];
+        pidfd_ = syscall(SYS_pidfd_open, pid, 0);
+        deadline_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        cpuCheck_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        tick_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        record_ = timeline != nullptr ? timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC) : -1;
+        hasCpuClock_ = clock_getcpuclockid(pid, &cpuClock_) == 0;
+        group_ = getpgid(pid) == pid;
+        checksCpuTime_ = cpuTimeLimit > 0 && (cgroup != nullptr || hasCpuClock_);
+        char path[64];
         snprintf(path, sizeof(path), "/proc/%d/statm", pid);
-        FILE *file = fopen(path, "r");
-        if (file == NULL)
+        statm_ = open(path, O_RDONLY | O_CLOEXEC);
+        snprintf(path, sizeof(path), "/proc/%d/io", pid);
+        io_ = open(path, O_RDONLY | O_CLOEXEC);
+        if (cgroup == nullptr)
         {
-            // perror("fopen");
-            break;
+            descendants_.open(pid);
         }
-        long size, resident, share, text, lib, data, dt;
-        if (fscanf(file, "%ld %ld %ld %ld %ld %ld %ld", &size, &resident, &share, &text, &lib, &data, &dt) != 7)
+
+        // A traced child only reports its stops through SIGCHLD, which must be blocked before it is resumed.
+        sigset_t childSignal;
+        sigemptyset(&childSignal);
+        sigaddset(&childSignal, SIGCHLD);
+        if (tracer != nullptr && pthread_sigmask(SIG_BLOCK, &childSignal, &oldMask_) == 0)
         {
-            // perror("fscanf");
-            fclose(file);
-            break;
+            exits_ = signalfd(-1, &childSignal, SFD_NONBLOCK | SFD_CLOEXEC);
         }
-        fclose(file);
-        long rss_in_bytes = resident * PAGE_SIZE;
-        long rss_in_kb = rss_in_bytes / 1024;
-        if (rss_in_kb > maxMemory)
+    }
+
+    Supervisor(const Supervisor &) = delete;
+    Supervisor &operator=(const Supervisor &) = delete;
+
+    ~Supervisor()
+    {
+        if (!reaped_)
         {
-            maxMemory = rss_in_kb;
+            ::kill(pid_, SIGKILL);
+            killTree();
+            waitpid(pid_, &usage_.status, __WALL);
         }
-        if (maxMemory > memoryLimit)
+        for (int fd : {pidfd_, deadline_, cpuCheck_, tick_, record_, statm_, io_, exits_})
         {
-            kill(pid, SIGKILL);
-            return -1;
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+        if (tracer_ != nullptr)
+        {
+            pthread_sigmask(SIG_SETMASK, &oldMask_, nullptr);
+        }
+        if (timeline_ != nullptr)
+        {
+            timeline_->detach();
+        }
+    }
+
+    /**
+     * @brief Adds the descriptors of the supervisor to an event loop, and starts the clocks.
+     *
+     * @param epfd The epoll instance of the event loop, which must outlive the supervisor.
+     * @throw std::runtime_error If the supervisor cannot be set up, in which case the child is killed and reaped.
+     */
+    void attach(int epfd)
+    {
+        auto watch = [&](int fd) {
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+        };
+        epfd_ = epfd;
+        if (pidfd_ < 0 || epfd < 0 || deadline_ < 0 || cpuCheck_ < 0 || tick_ < 0 || statm_ < 0 ||
+            watch(tracer_ != nullptr ? exits_ : pidfd_) < 0 || watch(deadline_) < 0 || watch(cpuCheck_) < 0 ||
+            watch(tick_) < 0 || (capture_ != nullptr && (watched_ = capture_->readEnd(), watch(watched_)) < 0) ||
+            (timeline_ != nullptr && (record_ < 0 || watch(record_) < 0 || timeline_->attach(pid_, start_) < 0)) ||
+            (tracer_ != nullptr && tracer_->attach(pid_) < 0))
+        {
+            ::kill(pid_, SIGKILL);
+            waitpid(pid_, &usage_.status, __WALL);
+            reaped_ = true;
+            running_ = false;
+            throw std::runtime_error("Failed to set up the supervisor");
+        }
+
+        if (timeLimit_ > 0)
+        {
+            auto remaining = start_ + timeLimit_ * 1000LL - monotonicMicros();
+            armTimer(deadline_, remaining > 0 ? remaining : 1, false);
+        }
+        if (checksCpuTime_)
+        {
+            armTimer(cpuCheck_, cpuTimeLimit_ * 1000LL, false);
+        }
+        if (cgroup_ == nullptr || !cgroup_->hasPeak() || checksCpuTime_)
+        {
+            armTimer(tick_, sampleInterval_ > 0 ? sampleInterval_ : 1000, true);
+        }
+        if (timeline_ != nullptr)
+        {
+            timeline_->record();
+            armTimer(record_, timeline_->interval(), true);
+        }
+        sample();
+    }
+
+    /**
+     * @brief Handles an event of the event loop.
+     *
+     * @param fd The descriptor which became readable.
+     * @return Whether the descriptor belongs to this supervisor.
+     */
+    bool handle(int fd) noexcept
+    {
+        uint64_t expirations;
+        if (fd == pidfd_)
+        {
+            running_ = false;
+            // The pidfd stays readable, it must not wake the event loop of the other supervisors.
+            epoll_ctl(epfd_, EPOLL_CTL_DEL, pidfd_, nullptr);
+        }
+        else if (fd == exits_ && exits_ >= 0)
+        {
+            signalfd_siginfo info;
+            while (read(exits_, &info, sizeof(info)) == sizeof(info))
+            {
+            }
+            reaped_ = tracer_->poll(pid_, io_, usage_, resources_);
+            running_ = !reaped_;
+        }
+        else if (fd == deadline_)
+        {
+            read(deadline_, &expirations, sizeof(expirations));
+            terminate(usage_.timeExceeded);
+        }
+        else if (fd == cpuCheck_)
+        {
+            read(cpuCheck_, &expirations, sizeof(expirations));
+            checkCpuTime();
+        }
+        else if (fd == tick_)
+        {
+            if (read(tick_, &expirations, sizeof(expirations)) == sizeof(expirations))
+            {
+                usage_.samples++;
+                usage_.missedSamples += expirations - 1;
+            }
+            sample();
+        }
+        else if (fd == record_ && record_ >= 0)
+        {
+            read(record_, &expirations, sizeof(expirations));
+            timeline_->record();
+        }
+        else if (capture_ != nullptr && fd == watched_ && watched_ >= 0)
+        {
+            drain();
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Returns whether the child is still running.
+     */
+    bool running() const noexcept
+    {
+        return running_;
+    }
+
+    /**
+     * @brief Kills the child, e.g. because the other side of an interaction failed, without giving it a verdict.
+     */
+    void kill() noexcept
+    {
+        if (running_)
+        {
+            killTree();
+        }
+    }
+
+    /**
+     * @brief Reaps the child once it has exited, and returns its resource usage.
+     */
+    Usage finish() noexcept
+    {
+        auto &usage = usage_;
+        usage.time = monotonicMicros() - start_;
+        // Whatever the command wrote before it exited is still in the pipe. The supervisor waits for a full
+        // destination to take it, but not forever: a reader which stopped reading must not hold the sandbox.
+        if (capture_ != nullptr)
+        {
+            drain();
+            auto now = monotonicMicros();
+            auto deadline = std::max(start_ + timeLimit_ * 1000LL, now + DRAIN_GRACE_PERIOD * 1000LL);
+            while (watched_ == capture_->target())
+            {
+                pollfd target{watched_, POLLOUT, 0};
+                int ready = now < deadline ? poll(&target, 1, (deadline - now + 999) / 1000) : 0;
+                if (ready == 0)
+                {
+                    capture_->discard();
+                }
+                else if (ready < 0 && errno != EINTR)
+                {
+                    break;
+                }
+                drain();
+                now = monotonicMicros();
+            }
+            usage.output = capture_->size();
+            usage.outputDropped = capture_->discarded();
+        }
+        // The I/O counters disappear with the zombie, read them before reaping it. The zombie also keeps its process
+        // group from being reused until the rest of the tree is killed.
+        if (!reaped_)
+        {
+            if (io_ >= 0)
+            {
+                readIoCounters(io_, usage);
+            }
+            killTree();
+            wait4(pid_, &usage.status, 0, &resources_);
+            reaped_ = true;
+            if (group_ && cgroup_ == nullptr)
+            {
+                waitProcessGroup(pid_, 100);
+            }
+        }
+        usage.userTime = resources_.ru_utime.tv_sec * 1000000LL + resources_.ru_utime.tv_usec;
+        usage.systemTime = resources_.ru_stime.tv_sec * 1000000LL + resources_.ru_stime.tv_usec;
+        usage.maxResident = resources_.ru_maxrss;
+        usage.minorFaults = resources_.ru_minflt;
+        usage.majorFaults = resources_.ru_majflt;
+        usage.voluntarySwitches = resources_.ru_nvcsw;
+        usage.involuntarySwitches = resources_.ru_nivcsw;
+        usage.untrackedProcesses = cgroup_ == nullptr ? descendants_.untracked() : 0;
+        // The rusage only includes the children the child waited for, the cgroup includes all of them.
+        long long userTime = usage.userTime, systemTime = usage.systemTime;
+        if (cgroup_ != nullptr && cgroup_->cpuUsage(userTime, systemTime) > usage.userTime + usage.systemTime)
+        {
+            usage.userTime = userTime;
+            usage.systemTime = systemTime;
+        }
+        // Likewise for the storage I/O, which the cgroup also counts per operation.
+        long long readBytes, writeBytes, readOps, writeOps;
+        if (cgroup_ != nullptr && cgroup_->ioUsage(readBytes, writeBytes, readOps, writeOps) == 0)
+        {
+            usage.readBytes = readBytes;
+            usage.writeBytes = writeBytes;
+            usage.readOps = readOps;
+            usage.writeOps = writeOps;
+        }
+        // The kernel limit may have fired first, and the last slice before the kill may overshoot the limit.
+        bool killedByKernel = WIFSIGNALED(usage.status) && WTERMSIG(usage.status) == SIGXCPU;
+        if (cpuTimeLimit_ > 0 && (killedByKernel || usage.userTime + usage.systemTime > cpuTimeLimit_ * 1000LL) &&
+            !usage.timeExceeded && !usage.memoryExceeded && !usage.outputExceeded)
+        {
+            usage.cpuTimeExceeded = true;
+        }
+        if (cgroup_ != nullptr)
+        {
+            auto peak = cgroup_->peakMemory();
+            if (peak > usage.memory)
+            {
+                usage.memory = peak;
+            }
+            if (cgroup_->oomKills() > 0 && !usage.timeExceeded && !usage.cpuTimeExceeded && !usage.outputExceeded)
+            {
+                usage.memoryExceeded = true;
+            }
+        }
+        if (capture_ != nullptr && capture_->comparing())
+        {
+            auto result = capture_->finish();
+            bool succeeded = WIFEXITED(usage.status) && WEXITSTATUS(usage.status) == 0;
+            // Output cut short by a crash is neither accepted nor wrong, the verdict is that of the crash.
+            usage.answer = result == OutputComparator::TRUNCATED && !succeeded ? -1 : result == OutputComparator::MATCH;
+            usage.wrongAnswer = usage.wrongAnswer || result == OutputComparator::MISMATCH ||
+                                (result == OutputComparator::TRUNCATED && succeeded);
+        }
+        return usage;
+    }
+
+  private:
+    // Kills the child for the first limit it exceeds, the verdict is not overwritten afterwards.
+    void terminate(bool &exceeded) noexcept
+    {
+        if (!usage_.timeExceeded && !usage_.cpuTimeExceeded && !usage_.memoryExceeded && !usage_.outputExceeded &&
+            !usage_.wrongAnswer)
+        {
+            exceeded = true;
+            killTree();
+        }
+    }
+
+    // Kills the child, then the rest of its tree, which cgroup.kill does atomically, so that no fork escapes.
+    void killTree() noexcept
+    {
+        syscall(SYS_pidfd_send_signal, pidfd_, SIGKILL, nullptr, 0);
+        if ((cgroup_ == nullptr || cgroup_->kill() < 0) && group_)
+        {
+            ::kill(-pid_, SIGKILL);
+        }
+    }
+
+    long long cpuTime() noexcept
+    {
+        long long user, system;
+        if (cgroup_ != nullptr)
+        {
+            return cgroup_->cpuUsage(user, system);
+        }
+        auto used = cpuClockMicros(cpuClock_);
+        return used < 0 ? -1 : used + descendantsCpuTime_;
+    }
+
+    void checkCpuTime() noexcept
+    {
+        auto used = cpuTime();
+        if (used < 0)
+        {
+            return;
+        }
+        auto remaining = cpuTimeLimit_ * 1000LL - used;
+        if (remaining <= 0)
+        {
+            terminate(usage_.cpuTimeExceeded);
+        }
+        else
+        {
+            armTimer(cpuCheck_, remaining, false);
+        }
+    }
+
+    // Without a cgroup, the descendants are only seen by the sampling tick.
+    void sample() noexcept
+    {
+        if (cgroup_ == nullptr)
+        {
+            descendants_.sample(descendantsMemory_, descendantsCpuTime_);
+            auto memory = readResidentMemory(statm_);
+            if (memory >= 0 && memory + descendantsMemory_ > usage_.memory)
+            {
+                usage_.memory = memory + descendantsMemory_;
+            }
+            if (memoryLimit_ > 0 && usage_.memory > memoryLimit_)
+            {
+                terminate(usage_.memoryExceeded);
+            }
+        }
+        else if (!cgroup_->hasPeak())
+        {
+            auto memory = cgroup_->currentMemory();
+            if (memory > usage_.memory)
+            {
+                usage_.memory = memory;
+            }
+        }
+        if (checksCpuTime_)
+        {
+            auto used = cpuTime();
+            if (used >= cpuTimeLimit_ * 1000LL)
+            {
+                terminate(usage_.cpuTimeExceeded);
+            }
+        }
+    }
+
+    // The pipe stays readable once closed, so it is only watched until then. While the destination is full, the
+    // destination is watched instead, the pipe would wake the event loop until it is emptied.
+    void drain() noexcept
+    {
+        int result = capture_->drain();
+        if (result == OutputCapture::EXCEEDED)
+        {
+            terminate(usage_.outputExceeded);
+        }
+        else if (capture_->mismatched())
+        {
+            terminate(usage_.wrongAnswer);
+        }
+        int next = result == OutputCapture::BLOCKED ? capture_->target()
+                   : result == OutputCapture::EMPTY ? capture_->readEnd()
+                                                    : -1;
+        if (next == watched_)
+        {
+            return;
+        }
+        if (watched_ >= 0)
+        {
+            epoll_ctl(epfd_, EPOLL_CTL_DEL, watched_, nullptr);
+        }
+        epoll_event event{};
+        event.events = next == capture_->target() ? EPOLLOUT : EPOLLIN;
+        event.data.fd = next;
+        if (next == capture_->target() && epoll_ctl(epfd_, EPOLL_CTL_ADD, next, &event) < 0)
+        {
+            // A destination which cannot be waited on is retried whenever the pipe is readable.
+            next = capture_->readEnd();
+            event.events = EPOLLIN;
+            event.data.fd = next;
+        }
+        if (next == capture_->readEnd())
+        {
+            epoll_ctl(epfd_, EPOLL_CTL_ADD, next, &event);
+        }
+        watched_ = next;
+    }
+
+    int pid_;
+    long long start_;
+    int timeLimit_;
+    int cpuTimeLimit_;
+    int memoryLimit_;
+    int sampleInterval_;
+    const Cgroup *cgroup_;
+    Tracer *tracer_;
+    OutputCapture *capture_;
+    TimelineRecorder *timeline_;
+    int epfd_ = -1;
+    int pidfd_ = -1;
+    int deadline_ = -1;
+    int cpuCheck_ = -1;
+    int tick_ = -1;
+    int record_ = -1;
+    int statm_ = -1;
+    int io_ = -1;
+    int exits_ = -1;
+    int watched_ = -1; // The end of the capture watched by the event loop, -1 for none
+    sigset_t oldMask_;
+    clockid_t cpuClock_{};
+    bool hasCpuClock_ = false;
+    bool group_ = false; // Whether the child leads a process group of its own
+    bool checksCpuTime_ = false;
+    DescendantSampler descendants_;
+    long descendantsMemory_ = 0;
+    long long descendantsCpuTime_ = 0;
+    Usage usage_{};
+    rusage resources_{};
+    bool running_ = true;
+    bool reaped_ = false;
+};
+
+/**
+ * @brief Supervises a child process until it exits, enforcing the time and memory limits, see Supervisor.
+ *
+ * The supervisor is a single-threaded event loop, which sleeps in epoll_wait until the next event of the child.
+ *
+ * @return The resource usage of the child.
+ * @throw std::runtime_error If the supervisor cannot be set up, in which case the child is killed and reaped.
+ */
+inline Usage supervise(int pid, long long start, int timeLimit, int cpuTimeLimit, int memoryLimit, int sampleInterval,
+                       const Cgroup *cgroup = nullptr, Tracer *tracer = nullptr, OutputCapture *capture = nullptr,
+                       TimelineRecorder *timeline = nullptr)
+{
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    Usage usage;
+    try
+    {
+        Supervisor supervisor(pid, start, timeLimit, cpuTimeLimit, memoryLimit, sampleInterval, cgroup, tracer,
+                              capture, timeline);
+        supervisor.attach(epfd);
+        while (supervisor.running())
+        {
+            epoll_event events[6];
+            int n = epoll_wait(epfd, events, 6, -1);
+            for (int i = 0; i < n; i++)
+            {
+                supervisor.handle(events[i].data.fd);
+            }
+        }
+        usage = supervisor.finish();
+    }
+    catch (...)
+    {
+        if (epfd >= 0)
+        {
+            close(epfd);
         }
+        throw;
     }
-    return maxMemory;
+    close(epfd);
+    return usage;
 }
 } // namespace bsdbx
 
-#endif // MONITOR_H
\ No newline at end of file
+#endif // MONITOR_H
@@ -0,0 +1,263 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bsdbx
+{
+
+/**
+ * @brief How the output of a run is compared against the expected output.
+ */
+enum class CompareMode
+{
+    TOKEN, // Token by token, ignoring the amount of whitespace
+    EXACT, // Byte for byte
+    FLOAT, // Token by token, numbers within a tolerance
+};
+
+/**
+ * @brief The settings of a sandbox run collected from the command line.
+ */
+struct Options
+{
+    bool mode = 0;                // 0 for runner, 1 for compiler
+    int timeLimit = 0;            // Wall time limit in miliseconds, 0 means unlimited
+    int cpuTimeLimit = 0;         // CPU time limit in miliseconds, 0 means unlimited
+    int memoryLimit = 0;          // Memory limit in KB, 0 means unlimited
+    int taskLimit = 0;            // Maximum number of processes and threads, 0 means unlimited
+    int ioBandwidthLimit = 0;     // Read and write bandwidth limit on every disk in KB/s, 0 means unlimited
+    int ioOpsLimit = 0;           // Read and write operations per second on every disk, 0 means unlimited
+    int sampleInterval = 1000;    // Memory sampling interval in microseconds
+    std::string cgroup{};         // Delegated cgroup v2 under which each run gets a cgroup, empty for none
+    int slots = 0;                // Number of cgroups recycled across runs, 0 for a new cgroup per run
+    std::string filterCache{};    // Directory of the compiled seccomp filter cache, empty for none
+    std::string warmCache{};      // Directory of the filter cache to fill instead of running a command
+    bool phaseTiming = false;     // Whether to print the time spent in every phase of the run
+    std::string serve{};          // Unix socket to serve jobs on instead of running a command
+    std::string batch{};          // Manifest of the test cases to run the command against, empty for a single run
+    std::string batchResult{};    // File to write the results of a batch to, empty for the standard output
+    int jobs = 0;                 // Number of parallel workers of a batch, 0 for one per CPU
+    bool failFast = false;        // Whether to skip the rest of a batch after the first failed case
+    int resultFd = -1;            // File descriptor to write the JSON result of the run to, -1 for none
+    std::string resultFile{};     // File to write the JSON result of the run to, empty for none
+    bool profileSyscalls = false; // Whether to record the system calls of the run with ptrace
+    std::string stdinFile{};      // File to use as the standard input, empty to inherit it
+    std::string stdoutFile{};     // File to write the standard output to, empty to inherit it
+    int outputLimit = 0;          // Output limit in KB, 0 means unlimited
+    std::string expectedFile{};   // File to compare the standard output against, empty for none
+    CompareMode compareMode{};    // How the standard output is compared against the expected output
+    double floatTolerance = 1e-6; // Absolute or relative tolerance of the float comparison
+    std::string timeline{};       // CSV file to write the memory timeline of the run to, empty for none
+    int timelineInterval = 1000;  // Interval between two samples of the timeline in microseconds
+    int timelineCapacity = 65536; // Number of the latest samples of the timeline which are kept
+    std::string allowRead{};      // Colon-separated paths the command may read, empty for the default of the mode
+    std::string allowWrite{};     // Colon-separated paths the command may write, empty for the default of the mode
+    std::string compileCache{};   // Directory of the compile cache, empty for none
+    std::string cacheArtifact{};  // File the compiler writes, to store in and restore from the compile cache
+    int cacheLimit = 1048576;     // Maximum size of the compile cache in KB
+    int scratch = 0;              // Size of the tmpfs scratch directory of a compiler run in KB, 0 for none
+    std::string interactor{};     // Command line of the interactor of an interactive problem, empty for none
+    bool interactorMode = 0;      // 0 for runner, 1 for compiler, the mode of the interactor
+    int repeat = 0;               // Number of measured repetitions of the run, 0 for a single run
+    int warmup = 0;               // Number of repetitions run before the measured ones
+    bool liveStats = false;       // Whether to publish the activity of the sandbox to the live statistics segment
+    std::vector<char *> args{};   // The command to run, terminated by a nullptr
+};
+
+/**
+ * @brief Describes a command line option understood by the sandbox.
+ *
+ * The option is accepted as "--name value", "--name=value" and, if a short name is given, "-s value". A flag takes no
+ * value and is only accepted as "--name" or "-s".
+ */
+struct OptionSpec
+{
+    std::string_view name;
+    std::string_view shortName;
+    std::function<void(std::string_view)> apply;
+    bool flag = false;
+};
+
+/**
+ * @brief Parses a sandbox mode name.
+ *
+ * @param m The name of the mode, either "runner" or "compiler".
+ * @return 1 for the compiler mode and 0 for the runner mode.
+ * @throw std::invalid_argument If the name is not a known mode.
+ */
+inline bool parseMode(std::string_view m)
+{
+    if (m == "compiler")
+    {
+        return 1;
+    }
+    else if (m == "runner")
+    {
+        return 0;
+    }
+    std::string ex = "Invalid mode: ";
+    ex += m;
+    throw std::invalid_argument(ex);
+}
+
+/**
+ * @brief Parses a comparison mode name.
+ *
+ * @param m The name of the mode, either "exact", "token" or "float".
+ * @throw std::invalid_argument If the name is not a known mode.
+ */
+inline CompareMode parseCompareMode(std::string_view m)
+{
+    if (m == "exact")
+    {
+        return CompareMode::EXACT;
+    }
+    else if (m == "token")
+    {
+        return CompareMode::TOKEN;
+    }
+    else if (m == "float")
+    {
+        return CompareMode::FLOAT;
+    }
+    std::string ex = "Invalid comparison mode: ";
+    ex += m;
+    throw std::invalid_argument(ex);
+}
+
+/**
+ * @brief Applies the sandbox options found in a list of arguments.
+ *
+ * The options of the sandbox may appear anywhere in the list. Only the first occurrence of each option is consumed,
+ * every other argument is returned in its original order.
+ *
+ * @param options The options to update.
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @return The arguments which are not options of the sandbox.
+ * @throw std::invalid_argument If an option is malformed.
+ */
+inline std::vector<char *> applyOptions(Options &options, int argc, char **argv)
+{
+    std::vector<char *> rest;
+    auto toInt = [](std::string_view s) { return std::stoi(std::string(s)); };
+    OptionSpec specs[] = {
+        {"--mode", "-m", [&](std::string_view v) { options.mode = parseMode(v); }},
+        {"--time-limit", "-t", [&](std::string_view v) { options.timeLimit = toInt(v); }},
+        {"--wall-time-limit", "", [&](std::string_view v) { options.timeLimit = toInt(v); }},
+        {"--cpu-time-limit", "", [&](std::string_view v) { options.cpuTimeLimit = toInt(v); }},
+        {"--memory-limit", "", [&](std::string_view v) { options.memoryLimit = toInt(v); }},
+        {"--task-limit", "", [&](std::string_view v) { options.taskLimit = toInt(v); }},
+        {"--io-bandwidth-limit", "", [&](std::string_view v) { options.ioBandwidthLimit = toInt(v); }},
+        {"--io-ops-limit", "", [&](std::string_view v) { options.ioOpsLimit = toInt(v); }},
+        {"--sample-interval", "", [&](std::string_view v) { options.sampleInterval = toInt(v); }},
+        {"--cgroup", "", [&](std::string_view v) { options.cgroup = v; }},
+        {"--slots", "", [&](std::string_view v) { options.slots = toInt(v); }},
+        {"--seccomp-cache", "", [&](std::string_view v) { options.filterCache = v; }},
+        {"--warm-seccomp-cache", "", [&](std::string_view v) { options.warmCache = v; }},
+        {"--phase-timing", "", [&](std::string_view) { options.phaseTiming = true; }, true},
+        {"--serve", "", [&](std::string_view v) { options.serve = v; }},
+        {"--batch", "", [&](std::string_view v) { options.batch = v; }},
+        {"--batch-result", "", [&](std::string_view v) { options.batchResult = v; }},
+        {"--jobs", "-j", [&](std::string_view v) { options.jobs = toInt(v); }},
+        {"--fail-fast", "", [&](std::string_view) { options.failFast = true; }, true},
+        {"--result-fd", "", [&](std::string_view v) { options.resultFd = toInt(v); }},
+        {"--result-file", "", [&](std::string_view v) { options.resultFile = v; }},
+        {"--profile-syscalls", "", [&](std::string_view) { options.profileSyscalls = true; }, true},
+        {"--stdin", "", [&](std::string_view v) { options.stdinFile = v; }},
+        {"--stdout", "", [&](std::string_view v) { options.stdoutFile = v; }},
+        {"--output-limit", "", [&](std::string_view v) { options.outputLimit = toInt(v); }},
+        {"--expected", "", [&](std::string_view v) { options.expectedFile = v; }},
+        {"--compare", "", [&](std::string_view v) { options.compareMode = parseCompareMode(v); }},
+        {"--float-tolerance", "", [&](std::string_view v) { options.floatTolerance = std::stod(std::string(v)); }},
+        {"--timeline", "", [&](std::string_view v) { options.timeline = v; }},
+        {"--timeline-interval", "", [&](std::string_view v) { options.timelineInterval = toInt(v); }},
+        {"--timeline-capacity", "", [&](std::string_view v) { options.timelineCapacity = toInt(v); }},
+        {"--allow-read", "", [&](std::string_view v) { options.allowRead = v; }},
+        {"--allow-write", "", [&](std::string_view v) { options.allowWrite = v; }},
+        {"--compile-cache", "", [&](std::string_view v) { options.compileCache = v; }},
+        {"--cache-artifact", "", [&](std::string_view v) { options.cacheArtifact = v; }},
+        {"--compile-cache-limit", "", [&](std::string_view v) { options.cacheLimit = toInt(v); }},
+        {"--scratch", "", [&](std::string_view v) { options.scratch = toInt(v); }},
+        {"--interactor", "", [&](std::string_view v) { options.interactor = v; }},
+        {"--interactor-mode", "", [&](std::string_view v) { options.interactorMode = parseMode(v); }},
+        {"--repeat", "", [&](std::string_view v) { options.repeat = toInt(v); }},
+        {"--warmup", "", [&](std::string_view v) { options.warmup = toInt(v); }},
+        {"--live-stats", "", [&](std::string_view) { options.liveStats = true; }, true},
+    };
+    bool found[sizeof(specs) / sizeof(specs[0])] = {};
+
+    for (int i = 0; i < argc; i++)
+    {
+        std::string_view str(argv[i]);
+        bool consumed = false;
+        for (size_t j = 0; j < sizeof(specs) / sizeof(specs[0]) && !consumed; j++)
+        {
+            auto &spec = specs[j];
+            if (found[j])
+            {
+                continue;
+            }
+            if (str == spec.name || (!spec.shortName.empty() && str == spec.shortName))
+            {
+                if (spec.flag)
+                {
+                    spec.apply("");
+                    found[j] = consumed = true;
+                    continue;
+                }
+                if (i >= argc - 1)
+                {
+                    std::string ex = "Missing argument for ";
+                    ex += spec.name;
+                    throw std::invalid_argument(ex);
+                }
+                i++;
+                spec.apply(argv[i]);
+                found[j] = consumed = true;
+            }
+            else if (!spec.flag && str.size() > spec.name.size() && str.substr(0, spec.name.size()) == spec.name &&
+                     str[spec.name.size()] == '=')
+            {
+                spec.apply(str.substr(spec.name.size() + 1));
+                found[j] = consumed = true;
+            }
+        }
+        if (!consumed)
+        {
+            rest.push_back(argv[i]);
+        }
+    }
+
+    return rest;
+}
+
+/**
+ * @brief Parses the command line of the sandbox.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments, argv[0] being the sandbox itself.
+ * @return The parsed options, with the command in args.
+ * @throw std::invalid_argument If an option is malformed or no executable is given for a run.
+ */
+inline Options parseOptions(int argc, char **argv)
+{
+    Options options;
+    options.args = applyOptions(options, argc - 1, argv + 1);
+
+    // Test whether there exists an executable path.
+    if (options.args.empty() && options.warmCache.empty() && options.serve.empty())
+    {
+        throw std::invalid_argument("No executable file");
+    }
+    options.args.push_back(nullptr);
+    return options;
+}
+} // namespace bsdbx
+
+#endif // OPTIONS_H
@@ -0,0 +1,303 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "monitor.h"
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <seccomp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace bsdbx
+{
+
+/**
+ * @brief Records the system calls of the sandboxed process tree with ptrace.
+ *
+ * Every thread of the command and of its children is stopped on entry to and on exit from each system call. The
+ * profiler counts the calls and measures the time between both stops, which includes the cost of the stops
+ * themselves, so a profiled run is much slower than a normal one. Only the calls made after the command is executed
+ * are recorded, the setup of the sandbox is left out.
+ *
+ * The kernel runs the seccomp filter after the entry stop, so the call which got a thread killed by the filter is the
+ * last one it entered, which is reported by killedBy().
+ *
+ * Once the command is reaped, the processes of the tree which are still traced are killed and reaped, so that they do
+ * not linger until the tracer exits. A thread which cannot be followed for lack of memory is detached instead.
+ */
+class SyscallProfiler final : public Tracer
+{
+  public:
+    /**
+     * @brief The statistics of one system call.
+     */
+    struct Entry
+    {
+        std::string name; // The name of the system call
+        long long count;  // The number of calls
+        long long time;   // The total time spent in the calls in nanoseconds
+    };
+
+    int attach(int pid) noexcept override
+    {
+        int status;
+        if (waitpid(pid, &status, __WALL) != pid || !WIFSTOPPED(status))
+        {
+            return -1;
+        }
+        long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE |
+                       PTRACE_O_TRACEEXEC | PTRACE_O_TRACEEXIT | PTRACE_O_EXITKILL;
+        if (ptrace(PTRACE_SETOPTIONS, pid, nullptr, options) < 0)
+        {
+            return -1;
+        }
+        try
+        {
+            threads_.reserve(64);
+            threads_[pid] = Thread{};
+        }
+        catch (...)
+        {
+            return -1;
+        }
+        return ptrace(PTRACE_SYSCALL, pid, nullptr, nullptr) < 0 ? -1 : 0;
+    }
+
+    bool poll(int pid, int ioFd, Usage &usage, rusage &resources) noexcept override
+    {
+        int status;
+        rusage threadResources;
+        int tid;
+        while ((tid = wait4(-1, &status, __WALL | WNOHANG, &threadResources)) > 0)
+        {
+            if (WIFEXITED(status) || WIFSIGNALED(status))
+            {
+                threads_.erase(tid);
+                if (tid == pid)
+                {
+                    usage.status = status;
+                    resources = threadResources;
+                    killRemaining();
+                    return true;
+                }
+                continue;
+            }
+            if (!WIFSTOPPED(status))
+            {
+                continue;
+            }
+
+            // A thread seen for the first time is a new child, which starts with a SIGSTOP of its own.
+            bool known = threads_.count(tid) > 0;
+            Thread *entry;
+            try
+            {
+                entry = &threads_[tid];
+            }
+            catch (...)
+            {
+                ptrace(PTRACE_DETACH, tid, nullptr, nullptr);
+                continue;
+            }
+            auto &thread = *entry;
+            int signal = 0;
+            int event = status >> 16;
+            if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+            {
+                syscallStop(tid, thread);
+            }
+            else if (event == PTRACE_EVENT_EXEC)
+            {
+                started_ = started_ || tid == pid;
+            }
+            else if (event == PTRACE_EVENT_EXIT)
+            {
+                exitStop(tid, thread, pid, ioFd, usage);
+            }
+            else if (event != 0 || (WSTOPSIG(status) == SIGSTOP && !known))
+            {
+                // Other events are only reported to let the tracer follow the new processes.
+            }
+            else
+            {
+                signal = WSTOPSIG(status);
+            }
+            ptrace(PTRACE_SYSCALL, tid, nullptr, (void *)(intptr_t)signal);
+        }
+        return false;
+    }
+
+    /**
+     * @brief Returns the statistics of every recorded system call, the most time-consuming first.
+     */
+    std::vector<Entry> entries() const
+    {
+        std::vector<Entry> entries;
+        for (auto &[key, stats] : stats_)
+        {
+            entries.push_back({resolve(key), stats.first, stats.second});
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.time > b.time; });
+        return entries;
+    }
+
+    /**
+     * @brief Returns the name of the system call in progress when the command was killed by SIGSYS, e.g. by the
+     * seccomp filter, or an empty string.
+     */
+    std::string killedBy() const
+    {
+        return killed_ ? resolve(killedBy_) : std::string();
+    }
+
+    /**
+     * @brief Prints the histogram, one system call per line with its count, total time and mean time in
+     * microseconds.
+     */
+    void print(std::ostream &out) const
+    {
+        out << std::fixed << std::setprecision(3);
+        auto killer = killedBy();
+        if (!killer.empty())
+        {
+            out << "killed by " << killer << std::endl;
+        }
+        out << "calls time(us) mean(us) syscall" << std::endl;
+        for (auto &entry : entries())
+        {
+            out << entry.count << ' ' << entry.time / 1000.0 << ' ' << entry.time / 1000.0 / entry.count << ' '
+                << entry.name << std::endl;
+        }
+    }
+
+  private:
+    using Key = std::pair<uint32_t, int>; // The audit architecture and the number of a system call
+
+    struct Thread
+    {
+        bool inSyscall = false; // Whether the thread is between the entry and the exit stops of a call
+        bool counted = false;   // Whether the last call entered is recorded
+        Key syscall{};          // The last call entered
+        long long entry = 0;    // The time of the last entry stop in nanoseconds
+    };
+
+    static long long nanos() noexcept
+    {
+        timespec spec;
+        clock_gettime(CLOCK_MONOTONIC, &spec);
+        return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+    }
+
+    static std::string resolve(const Key &key)
+    {
+        auto name = seccomp_syscall_resolve_num_arch(key.first, key.second);
+        if (name == nullptr)
+        {
+            return "syscall_" + std::to_string(key.second);
+        }
+        std::string result = name;
+        free(name);
+        return result;
+    }
+
+    void syscallStop(int tid, Thread &thread) noexcept
+    {
+        __ptrace_syscall_info info{};
+        if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, (void *)sizeof(info), &info) <= 0)
+        {
+            return;
+        }
+        if (info.op == PTRACE_SYSCALL_INFO_ENTRY)
+        {
+            thread.inSyscall = true;
+            thread.counted = started_;
+            thread.syscall = {info.arch, (int)info.entry.nr};
+            thread.entry = nanos();
+        }
+        else if (info.op == PTRACE_SYSCALL_INFO_EXIT && thread.inSyscall)
+        {
+            thread.inSyscall = false;
+            if (thread.counted)
+            {
+                record(thread, nanos());
+            }
+        }
+    }
+
+    void exitStop(int tid, Thread &thread, int pid, int ioFd, Usage &usage) noexcept
+    {
+        unsigned long code = 0;
+        ptrace(PTRACE_GETEVENTMSG, tid, nullptr, &code);
+        // Every thread of a process killed by SIGSYS stops here, the one which entered a call last is the culprit. It
+        // may already have reported the exit of the call, which the filter skipped before raising SIGSYS.
+        if (thread.counted && (code & 0x7f) == SIGSYS && thread.entry >= killedAt_)
+        {
+            killed_ = true;
+            killedBy_ = thread.syscall;
+            killedAt_ = thread.entry;
+        }
+        if (thread.inSyscall && thread.counted)
+        {
+            thread.inSyscall = false;
+            record(thread, nanos());
+        }
+        // The I/O counters disappear with the zombie, read them before reaping it.
+        if (tid == pid && ioFd >= 0)
+        {
+            readIoCounters(ioFd, usage);
+        }
+    }
+
+    // Kills the traced processes left once the command is reaped, and reaps them.
+    void killRemaining() noexcept
+    {
+        for (auto &[tid, thread] : threads_)
+        {
+            kill(tid, SIGKILL);
+        }
+        for (auto &[tid, thread] : threads_)
+        {
+            // A killed thread may still report its exit stop before it is gone.
+            int status;
+            while (waitpid(tid, &status, __WALL) == tid && WIFSTOPPED(status))
+            {
+                ptrace(PTRACE_CONT, tid, nullptr, nullptr);
+            }
+        }
+        threads_.clear();
+    }
+
+    void record(const Thread &thread, long long end) noexcept
+    {
+        try
+        {
+            auto &stats = stats_[thread.syscall];
+            stats.first++;
+            stats.second += end - thread.entry;
+        }
+        catch (...)
+        {
+        }
+    }
+
+    std::unordered_map<int, Thread> threads_;
+    std::map<Key, std::pair<long long, long long>> stats_; // The count and total time of every call
+    bool started_ = false;
+    bool killed_ = false;
+    Key killedBy_{};
+    long long killedAt_ = 0;
+};
+} // namespace bsdbx
+
+#endif // PROFILE_H
@@ -0,0 +1,221 @@
+#ifndef REPEAT_H
+#define REPEAT_H
+
+#include "capture.h"
+#include "filter.h"
+#include "options.h"
+#include "run.h"
+#include <algorithm>
+#include <cmath>
+#include <fcntl.h>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+#include <stdio.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace bsdbx
+{
+
+/**
+ * @brief The summary of a measure over the repetitions of a run.
+ */
+struct Statistics
+{
+    double min, median, p90, mean, stddev;
+};
+
+/**
+ * @brief Summarizes the samples of a measure, with nearest-rank percentiles.
+ *
+ * The p-th percentile of n sorted samples is the sample of rank ceil(p * n), e.g. the 9th of 10 for p90 and the 1st
+ * of 2 for the median.
+ */
+inline Statistics summarize(std::vector<double> samples)
+{
+    Statistics statistics{0, 0, 0, 0, 0};
+    if (samples.empty())
+    {
+        return statistics;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) {
+        // The rank is rounded down first when p * n is an integer up to the error of the product.
+        auto rank = (size_t)std::ceil(p * samples.size() - 1e-9);
+        return samples[std::min(samples.size(), std::max<size_t>(rank, 1)) - 1];
+    };
+    statistics.min = samples[0];
+    statistics.median = percentile(0.5);
+    statistics.p90 = percentile(0.9);
+    for (auto sample : samples)
+    {
+        statistics.mean += sample / samples.size();
+    }
+    for (auto sample : samples)
+    {
+        statistics.stddev += (sample - statistics.mean) * (sample - statistics.mean) / samples.size();
+    }
+    statistics.stddev = std::sqrt(statistics.stddev);
+    return statistics;
+}
+
+/**
+ * @brief Runs a command options.warmup + options.repeat times under the same filter and limits, one after the other.
+ *
+ * Every run reads the same input from the start: options.stdinFile, or else the standard input of the sandbox
+ * unless it is a terminal, sealed in a memfd once. With options.stdoutFile, the file is truncated before every run,
+ * so that it holds the output of the last one. The warm-up runs are not measured.
+ *
+ * @param options The options of the runs.
+ * @param filter The prepared filter of the mode of the runs.
+ * @param executable The name of the executable to pass to execve, as returned by prepareFilter().
+ * @param envp The environment of the command.
+ * @return The resource usage of every measured run.
+ * @throw std::runtime_error If the input or output cannot be opened, or a run cannot be started.
+ */
+inline std::vector<Usage> runRepeated(const Options &options, const Filter &filter, const char *executable,
+                                      char **envp)
+{
+    int input = -1;
+    if (!options.stdinFile.empty() || !isatty(STDIN_FILENO))
+    {
+        input = sealInput(options.stdinFile.empty() ? "/dev/stdin" : options.stdinFile);
+        if (input < 0)
+        {
+            throw std::runtime_error("Failed to read the input");
+        }
+    }
+
+    std::vector<Usage> usages;
+    for (int i = 0; i < options.warmup + options.repeat; i++)
+    {
+        int stdio[3] = {-1, -1, -1};
+        if (input >= 0)
+        {
+            stdio[0] = openInput(input);
+        }
+        if (!options.stdoutFile.empty())
+        {
+            stdio[1] = open(options.stdoutFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        }
+        if ((input >= 0 && stdio[0] < 0) || (!options.stdoutFile.empty() && stdio[1] < 0))
+        {
+            for (int fd : {stdio[0], stdio[1], input})
+            {
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+            }
+            throw std::runtime_error("Failed to open the input or output of a run");
+        }
+
+        Usage usage;
+        try
+        {
+            usage = run(options, filter, executable, envp, stdio);
+        }
+        catch (...)
+        {
+            for (int fd : {stdio[0], stdio[1], input})
+            {
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+            }
+            throw;
+        }
+        for (int fd : {stdio[0], stdio[1]})
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+        if (i >= options.warmup)
+        {
+            usages.push_back(usage);
+        }
+    }
+    if (input >= 0)
+    {
+        close(input);
+    }
+    return usages;
+}
+
+/**
+ * @brief Summarizes the wall time, CPU time and peak memory of the repetitions of a run.
+ *
+ * @param usages The resource usage of every run.
+ * @param wallTime Receives the summary of the wall times in microseconds.
+ * @param cpuTime Receives the summary of the user plus system CPU times in microseconds.
+ * @param memory Receives the summary of the peak memory in KB.
+ * @return The number of runs whose verdict is not "OK".
+ */
+inline int summarizeRuns(const std::vector<Usage> &usages, Statistics &wallTime, Statistics &cpuTime,
+                         Statistics &memory)
+{
+    std::vector<double> wall, cpu, peak;
+    int failed = 0;
+    for (auto &usage : usages)
+    {
+        wall.push_back(usage.time);
+        cpu.push_back(usage.userTime + usage.systemTime);
+        peak.push_back(usage.memory);
+        failed += std::string(verdict(usage)) != "OK";
+    }
+    wallTime = summarize(wall);
+    cpuTime = summarize(cpu);
+    memory = summarize(peak);
+    return failed;
+}
+
+/**
+ * @brief Prints the summary of the repetitions of a run.
+ *
+ * The first line gives the number of measured runs and of failed runs, and the next ones the minimum, median, 90th
+ * percentile, mean and standard deviation of the wall time and the CPU time in miliseconds, and of the peak memory
+ * in KB, as name=value pairs.
+ */
+inline void printRepetitions(std::ostream &out, const std::vector<Usage> &usages)
+{
+    Statistics wallTime, cpuTime, memory;
+    int failed = summarizeRuns(usages, wallTime, cpuTime, memory);
+    out << "runs " << usages.size() << " failed " << failed << std::endl;
+    auto line = [&](const char *name, const Statistics &statistics, double scale) {
+        out << name << std::fixed << std::setprecision(3) << " min=" << statistics.min / scale
+            << " median=" << statistics.median / scale << " p90=" << statistics.p90 / scale
+            << " mean=" << statistics.mean / scale << " stddev=" << statistics.stddev / scale << std::endl;
+    };
+    line("wall", wallTime, 1000);
+    line("cpu", cpuTime, 1000);
+    line("memory", memory, 1);
+}
+
+/**
+ * @brief Formats the summary of the repetitions of a run as a single-line JSON object.
+ *
+ * runs and failed count the measured runs and those whose verdict is not "OK", and wall_time_us, cpu_time_us and
+ * memory_kb hold the min, median, p90, mean and stddev of every measure.
+ */
+inline std::string formatRepetitions(const std::vector<Usage> &usages)
+{
+    Statistics wallTime, cpuTime, memory;
+    int failed = summarizeRuns(usages, wallTime, cpuTime, memory);
+    auto object = [](const Statistics &statistics) {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer), "{\"min\":%.0f,\"median\":%.0f,\"p90\":%.0f,\"mean\":%.1f,\"stddev\":%.1f}",
+                 statistics.min, statistics.median, statistics.p90, statistics.mean, statistics.stddev);
+        return std::string(buffer);
+    };
+    return "{\"runs\":" + std::to_string(usages.size()) + ",\"failed\":" + std::to_string(failed) +
+           ",\"wall_time_us\":" + object(wallTime) + ",\"cpu_time_us\":" + object(cpuTime) +
+           ",\"memory_kb\":" + object(memory) + "}\n";
+}
+} // namespace bsdbx
+
+#endif // REPEAT_H
@@ -0,0 +1,142 @@
+#ifndef RESULT_H
+#define RESULT_H
+
+#include "monitor.h"
+#include "profile.h"
+#include "run.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace bsdbx
+{
+
+/**
+ * @brief Formats the result of a run as a single-line JSON object.
+ *
+ * Times are in microseconds and memory in KB. exit_code is null if the command was killed by a signal, and signal is
+ * null if it exited normally. The I/O counters are null if /proc/<pid>/io could not be read: read_chars and
+ * write_chars count every byte passed to read and write calls, while read_bytes and write_bytes only count the bytes
+ * which reached the storage layer. output_bytes is the size of the captured output, null if it was not captured,
+ * and answer is "AC" or "WA" if the output was compared against the expected output, null otherwise or if the output
+ * was cut short by a crash. cached is true if the compilation was found in the compile cache, in which case nothing
+ * was run and the usage is zero.
+ * untracked_processes counts the descendants which were not sampled without a cgroup, so that the memory and CPU time
+ * may be short. output_dropped_bytes counts the captured output which never reached its destination, e.g. a
+ * reader which stopped reading.
+ *
+ * With a profiler, killed_by names the system call which got the command killed by SIGSYS (or is null), and syscalls
+ * lists the count and total time of every system call, the most time-consuming first.
+ *
+ * With an interactor, the verdict is that of the interaction, see interact(), and interactor is the result of the
+ * interactor as a nested object.
+ */
+inline std::string formatResult(const Usage &usage, const SyscallProfiler *profiler = nullptr,
+                                const Usage *interactor = nullptr)
+{
+    std::string json = "{";
+    auto field = [&](const char *name, const std::string &value) {
+        if (json.size() > 1)
+        {
+            json += ",";
+        }
+        json += "\"";
+        json += name;
+        json += "\":";
+        json += value;
+    };
+    auto number = [](long long value) { return std::to_string(value); };
+    auto counter = [](long long value) { return value >= 0 ? std::to_string(value) : std::string("null"); };
+
+    field("verdict", std::string("\"") + verdict(usage) + "\"");
+    field("exit_code", WIFEXITED(usage.status) ? number(WEXITSTATUS(usage.status)) : "null");
+    field("signal", WIFSIGNALED(usage.status) ? number(WTERMSIG(usage.status)) : "null");
+    field("wall_time_us", number(usage.time));
+    field("user_time_us", number(usage.userTime));
+    field("system_time_us", number(usage.systemTime));
+    field("memory_kb", number(usage.memory));
+    field("max_rss_kb", number(usage.maxResident));
+    field("minor_faults", number(usage.minorFaults));
+    field("major_faults", number(usage.majorFaults));
+    field("voluntary_context_switches", number(usage.voluntarySwitches));
+    field("involuntary_context_switches", number(usage.involuntarySwitches));
+    field("read_chars", counter(usage.readChars));
+    field("write_chars", counter(usage.writeChars));
+    field("read_bytes", counter(usage.readBytes));
+    field("write_bytes", counter(usage.writeBytes));
+    field("read_calls", counter(usage.readCalls));
+    field("write_calls", counter(usage.writeCalls));
+    field("read_ops", counter(usage.readOps));
+    field("write_ops", counter(usage.writeOps));
+    field("output_bytes", counter(usage.output));
+    field("answer", usage.answer < 0 ? "null" : usage.answer ? "\"AC\"" : "\"WA\"");
+    field("cached", usage.cached ? "true" : "false");
+    field("untracked_processes", number(usage.untrackedProcesses));
+    field("output_dropped_bytes", number(usage.outputDropped));
+    if (profiler != nullptr)
+    {
+        auto killer = profiler->killedBy();
+        field("killed_by", killer.empty() ? "null" : "\"" + killer + "\"");
+        std::string syscalls = "[";
+        for (auto &entry : profiler->entries())
+        {
+            syscalls += syscalls.size() > 1 ? "," : "";
+            syscalls += "{\"name\":\"" + entry.name + "\",\"count\":" + number(entry.count) +
+                        ",\"time_ns\":" + number(entry.time) + "}";
+        }
+        field("syscalls", syscalls + "]");
+    }
+    if (interactor != nullptr)
+    {
+        auto nested = formatResult(*interactor);
+        nested.pop_back();
+        field("interactor", nested);
+    }
+    json += "}\n";
+    return json;
+}
+
+/**
+ * @brief Writes a whole string to a file descriptor.
+ *
+ * @return Returns 0 on success, or -1 on failure with errno set.
+ */
+inline int writeString(int fd, const std::string &content) noexcept
+{
+    for (size_t written = 0; written < content.size();)
+    {
+        auto n = write(fd, content.data() + written, content.size() - written);
+        if (n < 0 && errno != EINTR)
+        {
+            return -1;
+        }
+        written += n > 0 ? n : 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the JSON result of a run to a file descriptor.
+ *
+ * @return Returns 0 on success, or -1 on failure with errno set.
+ */
+inline int writeResult(int fd, const Usage &usage, const SyscallProfiler *profiler = nullptr,
+                       const Usage *interactor = nullptr) noexcept
+{
+    std::string json;
+    try
+    {
+        json = formatResult(usage, profiler, interactor);
+    }
+    catch (...)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    return writeString(fd, json);
+}
+} // namespace bsdbx
+
+#endif // RESULT_H
@@ -1,24 +1,34 @@
 #ifndef RULE_H
 #define RULE_H
 
+#include <errno.h>
 #include <fcntl.h>
 #include <seccomp.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string>
 #include <unistd.h>
 
 namespace bsdbx
 {
 /**
- * @brief Loads a general seccomp rule that whitelists a predefined set of system calls.
+ * @brief Builds a general seccomp rule that whitelists a predefined set of system calls.
  *
- * This function initializes a seccomp filter context with a default action of killing the process.
- * It then adds a whitelist of system calls that are allowed to be executed. If any of the system
- * calls cannot be added to the whitelist, the function releases the seccomp context and returns
- * the error code. Finally, it loads the seccomp rules into the kernel and releases the context.
+ * This function initializes a seccomp filter context for the native architecture with a default action of killing
+ * the process. It then adds a whitelist of system calls that are allowed to be executed, leaving out the excluded
+ * ones so that a mode can ban or restrict them within the same filter. Entries of the whitelist which do not exist on
+ * the native architecture are skipped. If any of the system calls cannot be added to the whitelist, the function
+ * releases the seccomp context and returns the error code.
  *
+ * The filter is compiled into a binary tree where libseccomp supports it, and the hottest system calls are given the
+ * highest priority so that they are matched first otherwise.
+ *
+ * @param context Receives the filter context on success, which the caller has to release.
+ * @param excluded The system calls to leave out of the whitelist.
+ * @param excludedCount The number of excluded system calls.
  * @return int Returns 0 on success, or a negative error code on failure.
  */
-inline int loadGeneralRule() noexcept
+inline int buildGeneralRule(scmp_filter_ctx &context, const int *excluded = nullptr, size_t excludedCount = 0) noexcept
 {
     // Define a whitelist of actions
     int actions[] = {SCMP_SYS(_llseek),
@@ -436,10 +446,31 @@ inline int loadGeneralRule() noexcept
                      SCMP_SYS(write),
                      SCMP_SYS(writev)};
 
+    // The system calls most programs issue all the time
+    int hotActions[] = {SCMP_SYS(read),   SCMP_SYS(write),         SCMP_SYS(mmap),           SCMP_SYS(brk),
+                        SCMP_SYS(futex),  SCMP_SYS(munmap),        SCMP_SYS(clock_gettime),  SCMP_SYS(lseek),
+                        SCMP_SYS(close),  SCMP_SYS(rt_sigprocmask)};
+
     // Add the rule in the whitelist
-    auto context = seccomp_init(SCMP_ACT_KILL);
+    context = seccomp_init(SCMP_ACT_KILL);
+    if (context == nullptr)
+    {
+        return -ENOMEM;
+    }
+    // Older versions of libseccomp only generate a linear filter, where the priorities still apply.
+    seccomp_attr_set(context, SCMP_FLTATR_CTL_OPTIMIZE, 2);
     for (auto action : actions)
     {
+        // Negative numbers are system calls of other architectures.
+        bool skip = action < 0;
+        for (size_t i = 0; i < excludedCount && !skip; i++)
+        {
+            skip = excluded[i] == action;
+        }
+        if (skip)
+        {
+            continue;
+        }
         int result =
             seccomp_rule_add(context, SCMP_ACT_ALLOW, action, 0); // Get the result of adding rule to the context
         if (result < 0)
@@ -448,67 +479,107 @@ inline int loadGeneralRule() noexcept
             return result;
         }
     }
+    uint8_t priority = 255;
+    for (auto action : hotActions)
+    {
+        if (action >= 0)
+        {
+            seccomp_syscall_priority(context, action, priority--);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Loads the general seccomp rule built by buildGeneralRule() into the kernel.
+ *
+ * @return int Returns 0 on success, or a negative error code on failure.
+ */
+inline int loadGeneralRule() noexcept
+{
+    scmp_filter_ctx context;
+    auto result = buildGeneralRule(context);
+    if (result < 0)
+    {
+        return result;
+    }
 
     // Load the rules
-    auto result = seccomp_load(context); // Fetch the result of loading the rules
+    result = seccomp_load(context); // Fetch the result of loading the rules
     seccomp_release(context);
     return result;
 }
 
 /**
- * @brief Loads and applies security rules for a runner.
+ * @brief Builds the security rules for a runner as a single filter.
  *
- * This function initializes a seccomp context and applies a set of security rules to restrict certain system calls.
- * It first loads general rules, then defines and bans specific actions, and finally adds rules related to file
- * execution.
+ * This function builds the general rule without the banned actions, so that they are killed by its default action.
+ * The system calls related to file execution are only allowed under conditions: execve may only run the given file,
+ * and open and openat may not open files for writing, unless Landlock restricts the files the command may write.
+ * creat and openat2, which would bypass the flag checks, are banned whether Landlock is used or not.
  *
- * @param filename The name of the file to be executed, used in the execve rule.
+ * @param filename The name of the file to be executed, used in the execve rule. The rule compares the address of the
+ * name, so execve has to be called with this very pointer.
+ * @param context Receives the filter context on success, which the caller has to release.
+ * @param landlock Whether the command is restricted by a LandlockPolicy, which makes the flag checks unnecessary.
  * @return Returns 0 on success, or a negative error code on failure.
  */
-int loadRunnerRule(const char filename[])
+inline int buildRunnerRule(const char filename[], scmp_filter_ctx &context, bool landlock = false) noexcept
 {
-    // Load the general rules
-    auto preload = loadGeneralRule();
-    if (preload < 0)
-    {
-        return preload;
-    }
-
-    // Define the banned actions
+    // Define the banned actions, as well as the ones only allowed under conditions
     int bannedActions[] = {SCMP_SYS(socket),    SCMP_SYS(setuid),   SCMP_SYS(setgid),   SCMP_SYS(setpgid),
                            SCMP_SYS(setsid),    SCMP_SYS(setreuid), SCMP_SYS(setregid), SCMP_SYS(setgroups),
                            SCMP_SYS(setrlimit), SCMP_SYS(vfork),    SCMP_SYS(chmod),    SCMP_SYS(chown),
                            SCMP_SYS(chown32),   SCMP_SYS(fchmod),   SCMP_SYS(fchown),   SCMP_SYS(fchownat),
                            SCMP_SYS(link),      SCMP_SYS(shutdown), SCMP_SYS(seccomp),  SCMP_SYS(rmdir),
-                           SCMP_SYS(rename)};
+                           SCMP_SYS(rename),    SCMP_SYS(execve),   SCMP_SYS(creat),    SCMP_SYS(openat2),
+                           SCMP_SYS(open),      SCMP_SYS(openat)};
 
-    auto context = seccomp_init(SCMP_ACT_ALLOW);
-    for (auto action : bannedActions)
+    // Landlock denies the writes on its own, so open and openat, which come last, are allowed without checking their
+    // flags. creat and openat2 stay banned either way.
+    size_t bannedCount = sizeof(bannedActions) / sizeof(bannedActions[0]) - (landlock ? 2 : 0);
+    auto result = buildGeneralRule(context, bannedActions, bannedCount);
+    if (result < 0)
     {
-        auto result = seccomp_rule_add(context, SCMP_ACT_KILL, action, 0);
-        if (result < 0)
-        {
-            seccomp_release(context);
-            return result;
-        }
+        return result;
     }
 
     // Add rules related to file execution
     int probe = 0;
     probe +=
-        seccomp_rule_add(context, SCMP_ACT_KILL, SCMP_SYS(execve), 1, SCMP_A0(SCMP_CMP_NE, (scmp_datum_t)(filename)));
-    probe +=
-        seccomp_rule_add(context, SCMP_ACT_KILL, SCMP_SYS(open), 1, SCMP_CMP(1, SCMP_CMP_MASKED_EQ, O_RDWR, O_RDWR));
-    probe += seccomp_rule_add(context, SCMP_ACT_KILL, SCMP_SYS(openat), 1,
-                              SCMP_CMP(2, SCMP_CMP_MASKED_EQ, O_WRONLY, O_WRONLY));
-    probe +=
-        seccomp_rule_add(context, SCMP_ACT_KILL, SCMP_SYS(openat), 1, SCMP_CMP(2, SCMP_CMP_MASKED_EQ, O_RDWR, O_RDWR));
+        seccomp_rule_add(context, SCMP_ACT_ALLOW, SCMP_SYS(execve), 1, SCMP_A0(SCMP_CMP_EQ, (scmp_datum_t)(filename)));
+    if (!landlock)
+    {
+        // O_CREAT and O_TRUNC modify files even without write access.
+        const scmp_datum_t writing = O_WRONLY | O_RDWR | O_CREAT | O_TRUNC;
+        probe += seccomp_rule_add(context, SCMP_ACT_ALLOW, SCMP_SYS(open), 1,
+                                  SCMP_CMP(1, SCMP_CMP_MASKED_EQ, writing, 0));
+        probe += seccomp_rule_add(context, SCMP_ACT_ALLOW, SCMP_SYS(openat), 1,
+                                  SCMP_CMP(2, SCMP_CMP_MASKED_EQ, writing, 0));
+    }
 
     if (probe < 0)
     {
         seccomp_release(context);
         return probe;
     }
+    return 0;
+}
+
+/**
+ * @brief Loads and applies security rules for a runner.
+ *
+ * @param filename The name of the file to be executed, used in the execve rule.
+ * @return Returns 0 on success, or a negative error code on failure.
+ */
+inline int loadRunnerRule(const char filename[]) noexcept
+{
+    scmp_filter_ctx context;
+    auto probe = buildRunnerRule(filename, context);
+    if (probe < 0)
+    {
+        return probe;
+    }
 
     // Load the rules
     probe += seccomp_load(context);
@@ -517,49 +588,46 @@ int loadRunnerRule(const char filename[])
 }
 
 /**
- * @brief Loads the compiler rule by initializing and configuring seccomp rules.
+ * @brief Builds the compiler rule as a single filter.
  *
- * This function first loads the general rule using `loadGeneralRule()`. If the loading fails,
- * it returns the error code. Then, it defines a set of banned system calls and adds them to
- * the seccomp context with the action `SCMP_ACT_KILL`. Finally, it loads the seccomp rules
- * and releases the context.
+ * This function builds the general rule without a set of banned system calls, so that they are killed by its default
+ * action.
  *
+ * @param context Receives the filter context on success, which the caller has to release.
  * @return int Returns 0 on success, or a negative error code on failure.
  */
-int loadCompilerRule()
+inline int buildCompilerRule(scmp_filter_ctx &context) noexcept
 {
-    // Load the general rule
-    int preload = loadGeneralRule();
-    if (preload < 0)
-    {
-        return preload;
-    }
-
     // Define the banned actions
     int bannedRules[] = {
         SCMP_SYS(socket),   SCMP_SYS(setuid),   SCMP_SYS(setgid),    SCMP_SYS(setpgid),   SCMP_SYS(setsid),
         SCMP_SYS(setreuid), SCMP_SYS(setregid), SCMP_SYS(setgroups), SCMP_SYS(setrlimit), SCMP_SYS(seccomp),
     };
 
-    // Add the banned actions to the context
-    auto context = seccomp_init(SCMP_ACT_ALLOW);
-    for (auto action : bannedRules)
+    return buildGeneralRule(context, bannedRules, sizeof(bannedRules) / sizeof(bannedRules[0]));
+}
+
+/**
+ * @brief Loads the compiler rule by initializing and configuring seccomp rules.
+ *
+ * @return int Returns 0 on success, or a negative error code on failure.
+ */
+inline int loadCompilerRule() noexcept
+{
+    scmp_filter_ctx context;
+    int result = buildCompilerRule(context);
+    if (result < 0)
     {
-        auto result = seccomp_rule_add(context, SCMP_ACT_KILL, action, 0);
-        if (result < 0)
-        {
-            seccomp_release(context);
-            return result;
-        }
+        return result;
     }
 
     // Load the rules
-    int result = seccomp_load(context);
+    result = seccomp_load(context);
     seccomp_release(context);
     return result;
 }
 
-int loadBanFork()
+inline int loadBanFork()
 {
     auto context = seccomp_init(SCMP_ACT_ALLOW);
     auto result = seccomp_rule_add(context, SCMP_ACT_KILL, SCMP_SYS(fork), 0);
@@ -0,0 +1,512 @@
+#ifndef RUN_H
+#define RUN_H
+
+#include "cgroup.h"
+#include "filter.h"
+#include "landlock.h"
+#include "monitor.h"
+#include "options.h"
+#include "scratch.h"
+#include "stats.h"
+#include "timing.h"
+#include <atomic>
+#include <fcntl.h>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <pthread.h>
+#include <signal.h>
+#include <stdexcept>
+#include <string.h>
+#include <string>
+#include <sys/ptrace.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+namespace bsdbx
+{
+
+/**
+ * @brief A command started in the sandbox, which has not been reaped yet.
+ */
+struct Process
+{
+    int pid = -1;                                 // The process ID of the command
+    long long start = 0;                          // The value of monotonicMicros() when the command was forked
+    std::unique_ptr<Cgroup> cgroup{};             // The cgroup of the command, or nullptr if it has none
+    std::unique_ptr<OutputCapture> capture{};     // The capture of the standard output, or nullptr if not captured
+    std::unique_ptr<TimelineRecorder> timeline{}; // The recorder of the timeline, or nullptr if it is not recorded
+    std::unique_ptr<Scratch> scratch{};           // The scratch directory of a compiler run, or nullptr if it has none
+    bool terminal = false;                        // Whether the command was given the foreground of the terminal
+};
+
+/**
+ * @brief Returns whether a command reading from a descriptor should get the foreground of its terminal, i.e. the
+ * descriptor is a terminal and the sandbox is in its foreground.
+ */
+inline bool takesTerminal(int fd) noexcept
+{
+    return isatty(fd) && tcgetpgrp(fd) == getpgrp();
+}
+
+/**
+ * @brief Gives the foreground of the terminal on the standard input back to the sandbox once the command is done.
+ *
+ * The sandbox is then in the background, so SIGTTOU is blocked while it takes the terminal back.
+ */
+inline void reclaimTerminal(Process &process) noexcept
+{
+    if (!process.terminal)
+    {
+        return;
+    }
+    sigset_t stop, old;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGTTOU);
+    pthread_sigmask(SIG_BLOCK, &stop, &old);
+    tcsetpgrp(STDIN_FILENO, getpgrp());
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    process.terminal = false;
+}
+
+/**
+ * @brief Starts a command in the sandbox.
+ *
+ * The child side only makes async-signal-safe calls, so the command may be started from a multi-threaded process.
+ *
+ * The command leads a process group of its own, so that its whole tree can be killed without a cgroup. If it reads
+ * from the terminal the sandbox has the foreground of, the group is given the foreground, so that the command reads
+ * from the terminal and gets the signals typed on it; reap() gives it back.
+ *
+ * @param options The settings of the run, including the command.
+ * @param filter The prepared filter of the mode of the run.
+ * @param executable The name of the executable to pass to execve, as returned by prepareFilter().
+ * @param envp The environment of the command.
+ * @param stdio The file descriptors to use as the standard input, output and error of the command, or nullptr to
+ * inherit those of the sandbox. An entry of -1 inherits the corresponding descriptor.
+ * @param timer Receives the time spent in every phase of the run, or nullptr.
+ * @param tracer The tracer of the command, or nullptr. The same tracer must be passed to reap().
+ * @return The started command, to be passed to reap().
+ * @throw std::runtime_error If the command cannot be started, e.g. because its cgroup cannot be created or a task
+ * limit is given without a cgroup to enforce it.
+ */
+inline Process spawn(const Options &options, const Filter &filter, const char *executable, char **envp,
+                     const int stdio[3] = nullptr, PhaseTimer *timer = nullptr, Tracer *tracer = nullptr)
+{
+    static std::atomic<unsigned> runs{0};
+    auto lap = [&](const char *name) {
+        if (timer != nullptr)
+        {
+            timer->lap(name);
+        }
+    };
+
+    // Give the run a cgroup of its own if a delegated cgroup is given, otherwise fall back to sampling. A run whose
+    // cgroup cannot be set up fails rather than running with weaker limits, and a slot of the pool is waited for.
+    Process process;
+    if (options.cgroup.empty())
+    {
+        if (options.taskLimit > 0)
+        {
+            throw std::runtime_error("The task limit needs a cgroup with the pids controller");
+        }
+    }
+    else if (options.slots > 0)
+    {
+        process.cgroup = std::make_unique<Cgroup>();
+        if (process.cgroup->claim(options.cgroup, options.slots, options.memoryLimit, options.taskLimit,
+                                  options.ioBandwidthLimit, options.ioOpsLimit) < 0)
+        {
+            throw std::runtime_error("Failed to claim a cgroup slot");
+        }
+    }
+    else
+    {
+        process.cgroup = std::make_unique<Cgroup>();
+        if (process.cgroup->create(options.cgroup, "bsdbx-" + std::to_string(getpid()) + "-" + std::to_string(runs++),
+                                   options.memoryLimit, options.taskLimit, options.ioBandwidthLimit,
+                                   options.ioOpsLimit) < 0)
+        {
+            throw std::runtime_error("Failed to create the cgroup of the run");
+        }
+    }
+    auto cgroup = process.cgroup.get();
+    lap("cgroup");
+
+    // The output is only captured to enforce its limit or to compare it, otherwise the command writes to its
+    // destination directly.
+    int childStdio[3] = {-1, -1, -1};
+    for (int i = 0; stdio != nullptr && i < 3; i++)
+    {
+        childStdio[i] = stdio[i];
+    }
+    if (options.outputLimit > 0 || !options.expectedFile.empty())
+    {
+        process.capture = std::make_unique<OutputCapture>();
+        if (process.capture->open(childStdio[1] >= 0 ? childStdio[1] : STDOUT_FILENO, options.outputLimit * 1024LL) < 0)
+        {
+            throw std::runtime_error("Failed to capture the output");
+        }
+        if (!options.expectedFile.empty() &&
+            process.capture->compare(options.expectedFile, options.compareMode, options.floatTolerance) < 0)
+        {
+            throw std::runtime_error("Failed to read the expected output");
+        }
+        childStdio[1] = process.capture->writeEnd();
+    }
+
+    // The samples of the timeline are allocated before the run.
+    if (!options.timeline.empty())
+    {
+        process.timeline = std::make_unique<TimelineRecorder>();
+        if (process.timeline->open(options.timeline, options.timelineCapacity, options.timelineInterval) < 0)
+        {
+            throw std::runtime_error("Failed to create the timeline");
+        }
+    }
+
+    // A compiler gets its scratch directory as TMPDIR, the environment is built before the fork.
+    std::string tmpdir;
+    std::vector<char *> environment;
+    if (options.mode && options.scratch > 0)
+    {
+        process.scratch = std::make_unique<Scratch>();
+        if (process.scratch->create(options.scratch) < 0)
+        {
+            throw std::runtime_error("Failed to create the scratch directory");
+        }
+        tmpdir = "TMPDIR=" + process.scratch->path();
+        environment.push_back(tmpdir.data());
+        for (auto variable = envp; *variable != nullptr; variable++)
+        {
+            if (strncmp(*variable, "TMPDIR=", 7) != 0)
+            {
+                environment.push_back(*variable);
+            }
+        }
+        environment.push_back(nullptr);
+        envp = environment.data();
+    }
+    auto scratch = process.scratch.get();
+
+    // The filter relies on Landlock to restrict the files the command may write and to hide the caches from it.
+    LandlockPolicy landlock;
+    if (filter.landlock())
+    {
+        std::vector<std::string> readable, writable;
+        defaultPaths(options.mode, readable, writable);
+        if (!options.allowRead.empty())
+        {
+            readable = splitPaths(options.allowRead);
+        }
+        if (!options.allowWrite.empty())
+        {
+            writable = splitPaths(options.allowWrite);
+        }
+        if (scratch != nullptr)
+        {
+            writable.push_back(scratch->path());
+        }
+        // The filter cache holds the address the runner rule lets execve through, see Filter, and a compiler writing
+        // to the compile cache would poison the compilations of others.
+        std::vector<std::string> hidden;
+        for (auto directory : {&options.filterCache, &options.compileCache})
+        {
+            if (!directory->empty())
+            {
+                hidden.push_back(*directory);
+            }
+        }
+        for (auto &directory : hidden)
+        {
+            if (isBeneathAny(directory, writable))
+            {
+                throw std::runtime_error("The command may write to the cache directory " + directory);
+            }
+        }
+        if (landlock.create(readable, writable, hidden) < 0)
+        {
+            throw std::runtime_error("Failed to create the Landlock ruleset");
+        }
+    }
+
+    // The write end of the pipe is closed by execve, which tells the supervisor when the command starts. A traced
+    // command waits for the supervisor before execve, so it is not waited for.
+    int execPipe[2] = {-1, -1};
+    bool waitExec = timer != nullptr && tracer == nullptr;
+    if (waitExec && pipe2(execPipe, O_CLOEXEC) < 0)
+    {
+        throw std::runtime_error("Failed to create a pipe");
+    }
+
+    process.terminal = childStdio[0] < 0 && takesTerminal(STDIN_FILENO);
+    process.start = monotonicMicros();
+    process.pid = fork();
+
+    if (process.pid == 0)
+    {
+        if (setpgid(0, 0) < 0)
+        {
+            _exit(127);
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            if (childStdio[i] >= 0 && dup2(childStdio[i], i) < 0)
+            {
+                _exit(127);
+            }
+        }
+        // A new group is in the background, so the command takes the terminal itself before it may read from it.
+        if (process.terminal)
+        {
+            sigset_t stop, old;
+            sigemptyset(&stop);
+            sigaddset(&stop, SIGTTOU);
+            if (sigprocmask(SIG_BLOCK, &stop, &old) < 0 || tcsetpgrp(STDIN_FILENO, getpid()) < 0 ||
+                sigprocmask(SIG_SETMASK, &old, nullptr) < 0)
+            {
+                _exit(127);
+            }
+        }
+        if ((cgroup != nullptr && cgroup->enter() < 0) || setCpuTimeLimit(options.cpuTimeLimit) < 0 ||
+            (scratch != nullptr && scratch->enter() < 0))
+        {
+            _exit(127);
+        }
+        // Wait for the tracer to take over before the filter, which may forbid these calls.
+        if (tracer != nullptr && (ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) < 0 || raise(SIGSTOP) != 0))
+        {
+            _exit(127);
+        }
+
+        // Load security mode in the child only, the supervisor has to manage the cgroup afterwards.
+        if (landlock.restrict() < 0 || filter.install() < 0)
+        {
+            _exit(127);
+        }
+
+        // bsdbx::loadBanFork();
+        execve(executable, options.args.data(), envp);
+        _exit(127);
+    }
+    else if (process.pid < 0)
+    {
+        if (waitExec)
+        {
+            close(execPipe[0]);
+            close(execPipe[1]);
+        }
+        throw std::runtime_error("Failed to fork");
+    }
+
+    // Either side may win the race, the supervisor must see the group before it kills it.
+    setpgid(process.pid, process.pid);
+    if (process.capture != nullptr)
+    {
+        process.capture->closeWriteEnd();
+    }
+    lap("fork");
+    if (waitExec)
+    {
+        char byte;
+        close(execPipe[1]);
+        read(execPipe[0], &byte, 1);
+        close(execPipe[0]);
+        lap("execve");
+    }
+    return process;
+}
+
+/**
+ * @brief Returns the verdict of a run: "MLE", "TLE", "OLE", "FAIL" if the interactor failed, "WA" if the output did
+ * not match the expected output or was rejected by the interactor, "RE" if the command failed, and "OK" otherwise.
+ */
+inline const char *verdict(const Usage &usage) noexcept
+{
+    if (usage.memoryExceeded)
+    {
+        return "MLE";
+    }
+    else if (usage.timeExceeded || usage.cpuTimeExceeded)
+    {
+        return "TLE";
+    }
+    else if (usage.outputExceeded)
+    {
+        return "OLE";
+    }
+    else if (usage.judgeFailed)
+    {
+        return "FAIL";
+    }
+    else if (usage.wrongAnswer)
+    {
+        return "WA";
+    }
+    else if (!WIFEXITED(usage.status) || WEXITSTATUS(usage.status) != 0)
+    {
+        return "RE";
+    }
+    return "OK";
+}
+
+/**
+ * @brief Counts a run which was supervised to the end in the live statistics of the sandbox.
+ */
+inline void publishRun(LiveStats &stats, const Usage &usage) noexcept
+{
+    int index = 0;
+    while (index < LIVE_STATS_VERDICT_COUNT - 1 && strcmp(LIVE_STATS_VERDICTS[index], verdict(usage)) != 0)
+    {
+        index++;
+    }
+    stats.end(index, usage.time, usage.userTime + usage.systemTime, usage.samples, usage.missedSamples);
+}
+
+/**
+ * @brief Supervises a command started by spawn() until it exits, and tears its cgroup down.
+ *
+ * The timeline of the command, if recorded, is written once it has exited. The run is not failed if it cannot be
+ * written, the file is only meant for investigations.
+ *
+ * @param options The settings of the run.
+ * @param process The started command.
+ * @param timer Receives the time spent in every phase of the run, or nullptr.
+ * @param tracer The tracer passed to spawn(), or nullptr.
+ * @return The resource usage of the command.
+ * @throw std::runtime_error If the supervisor cannot be set up, in which case the command is killed.
+ */
+inline Usage reap(const Options &options, Process &process, PhaseTimer *timer = nullptr, Tracer *tracer = nullptr)
+{
+    auto stats = options.liveStats ? &LiveStats::instance() : nullptr;
+    if (stats != nullptr)
+    {
+        stats->begin();
+    }
+    Usage usage;
+    try
+    {
+        usage = supervise(process.pid, process.start, options.timeLimit, options.cpuTimeLimit, options.memoryLimit,
+                          options.sampleInterval, process.cgroup.get(), tracer, process.capture.get(),
+                          process.timeline.get());
+    }
+    catch (...)
+    {
+        reclaimTerminal(process);
+        if (stats != nullptr)
+        {
+            stats->cancel();
+        }
+        throw;
+    }
+    reclaimTerminal(process);
+    if (stats != nullptr)
+    {
+        publishRun(*stats, usage);
+    }
+    if (timer != nullptr)
+    {
+        timer->lap("supervise");
+    }
+    process.cgroup.reset();
+    process.capture.reset();
+    process.scratch.reset();
+    if (process.timeline != nullptr)
+    {
+        process.timeline->write();
+        process.timeline.reset();
+    }
+    if (timer != nullptr)
+    {
+        timer->lap("teardown");
+    }
+    return usage;
+}
+
+/**
+ * @brief Runs a command in the sandbox and supervises it until it exits.
+ *
+ * See spawn() for the parameters.
+ *
+ * @return The resource usage of the command.
+ * @throw std::runtime_error If the command cannot be started.
+ */
+inline Usage run(const Options &options, const Filter &filter, const char *executable, char **envp,
+                 const int stdio[3] = nullptr, PhaseTimer *timer = nullptr, Tracer *tracer = nullptr)
+{
+    auto process = spawn(options, filter, executable, envp, stdio, timer, tracer);
+    return reap(options, process, timer, tracer);
+}
+
+/**
+ * @brief Prints the resource usage of a run, one item per line.
+ *
+ * The lines are the peak memory in KB or "MLE", the wall time in miliseconds or "TLE", and the user and system CPU
+ * times in miliseconds or "TLE". If the output was captured, a line gives its size in bytes or "OLE", and if it was
+ * compared against the expected output, a last line gives "AC" if it matched and "WA" otherwise.
+ */
+inline void printUsage(std::ostream &out, const Usage &usage)
+{
+    out << std::fixed << std::setprecision(3);
+    if (!usage.memoryExceeded)
+    {
+        out << usage.memory << std::endl;
+    }
+    else
+    {
+        out << "MLE" << std::endl;
+    }
+
+    if (!usage.timeExceeded)
+    {
+        out << usage.time / 1000.0 << std::endl;
+    }
+    else
+    {
+        out << "TLE" << std::endl;
+    }
+
+    if (!usage.cpuTimeExceeded)
+    {
+        out << usage.userTime / 1000.0 << ' ' << usage.systemTime / 1000.0 << std::endl;
+    }
+    else
+    {
+        out << "TLE" << std::endl;
+    }
+
+    if (usage.outputExceeded)
+    {
+        out << "OLE" << std::endl;
+    }
+    else if (usage.output >= 0)
+    {
+        out << usage.output << std::endl;
+    }
+
+    if (usage.answer >= 0)
+    {
+        out << (usage.answer ? "AC" : "WA") << std::endl;
+    }
+}
+
+/**
+ * @brief Returns the exit code of the sandbox for a run: -1 if a limit was exceeded or the command did not exit
+ * normally, and the exit code of the command otherwise.
+ */
+inline int exitCode(const Usage &usage) noexcept
+{
+    if (usage.timeExceeded || usage.cpuTimeExceeded || usage.memoryExceeded || usage.outputExceeded ||
+        usage.wrongAnswer || usage.judgeFailed)
+    {
+        return -1;
+    }
+    else
+    {
+        return WIFEXITED(usage.status) ? WEXITSTATUS(usage.status) : -1;
+    }
+}
+} // namespace bsdbx
+
+#endif // RUN_H
@@ -0,0 +1,188 @@
+#include "sandbox.h"
+#include "filter.h"
+#include "options.h"
+#include "run.h"
+#include <signal.h>
+#include <stdexcept>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace bsdbx
+{
+
+struct Sandbox::State
+{
+    SandboxConfig config;
+    Options options{};
+    Process process{};
+    bool launched = false;
+    bool reaped = false;
+};
+
+Sandbox::Sandbox(SandboxConfig config) : state_(std::make_unique<State>())
+{
+    state_->config = std::move(config);
+}
+
+Sandbox::~Sandbox()
+{
+    // Nobody is going to wait for the command, so do not let it run on its own.
+    if (state_->launched && !state_->reaped)
+    {
+        auto pid = state_->process.pid;
+        if (getpgid(pid) == pid)
+        {
+            kill(-pid, SIGKILL);
+        }
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        // The command may have taken the terminal, which goes back to the caller like at the end of a run.
+        reclaimTerminal(state_->process);
+    }
+}
+
+void Sandbox::launch()
+{
+    auto &state = *state_;
+    auto &config = state.config;
+    if (state.launched)
+    {
+        throw std::logic_error("The sandbox was already launched");
+    }
+    if (config.command.empty())
+    {
+        throw std::invalid_argument("No executable file");
+    }
+
+    auto &options = state.options;
+    options.mode = config.mode;
+    options.timeLimit = config.timeLimit;
+    options.cpuTimeLimit = config.cpuTimeLimit;
+    options.memoryLimit = config.memoryLimit;
+    options.taskLimit = config.taskLimit;
+    options.ioBandwidthLimit = config.ioBandwidthLimit;
+    options.ioOpsLimit = config.ioOpsLimit;
+    options.outputLimit = config.outputLimit;
+    options.expectedFile = config.expectedFile;
+    options.compareMode = parseCompareMode(config.compareMode);
+    options.floatTolerance = config.floatTolerance;
+    options.sampleInterval = config.sampleInterval;
+    options.timeline = config.timeline;
+    options.timelineInterval = config.timelineInterval;
+    options.allowRead = config.allowRead;
+    options.allowWrite = config.allowWrite;
+    options.scratch = config.scratch;
+    options.cgroup = config.cgroup;
+    options.slots = config.slots;
+    options.filterCache = config.filterCache;
+    options.liveStats = config.liveStats;
+    for (auto &arg : config.command)
+    {
+        options.args.push_back(const_cast<char *>(arg.c_str()));
+    }
+    options.args.push_back(nullptr);
+
+    // The child may not allocate, so the environment is built before the fork.
+    std::vector<char *> environment;
+    for (auto &variable : config.environment)
+    {
+        environment.push_back(const_cast<char *>(variable.c_str()));
+    }
+    environment.push_back(nullptr);
+    auto envp = config.environment.empty() ? environ : environment.data();
+
+    if (options.liveStats && LiveStats::instance().error() != 0)
+    {
+        throw std::runtime_error("Failed to publish the live statistics: " +
+                                 std::string(strerror(LiveStats::instance().error())));
+    }
+
+    Filter filter;
+    const char *executable;
+    if (prepareFilter(filter, options.mode, options.filterCache, options.args[0], executable) < 0)
+    {
+        throw std::runtime_error("Failed to prepare the seccomp filter");
+    }
+
+    int stdio[3] = {config.stdinFd, config.stdoutFd, config.stderrFd};
+    try
+    {
+        state.process = spawn(options, filter, executable, envp, stdio);
+    }
+    catch (...)
+    {
+        if (executable != options.args[0])
+        {
+            unpinExecutable(executable);
+        }
+        throw;
+    }
+    // The child has its own copy of the name, free the address for the next sandbox to use the cached filter.
+    if (executable != options.args[0])
+    {
+        unpinExecutable(executable);
+    }
+    state.launched = true;
+}
+
+SandboxResult Sandbox::wait()
+{
+    auto &state = *state_;
+    if (!state.launched || state.reaped)
+    {
+        throw std::logic_error("The sandbox has no command to wait for");
+    }
+    // supervise() kills and reaps the command when it fails, so it is never waited for twice.
+    state.reaped = true;
+    auto usage = reap(state.options, state.process);
+
+    SandboxResult result;
+    result.verdict = verdict(usage);
+    result.exitCode = exitCode(usage);
+    result.status = usage.status;
+    result.time = usage.time;
+    result.userTime = usage.userTime;
+    result.systemTime = usage.systemTime;
+    result.memory = usage.memory;
+    result.timeExceeded = usage.timeExceeded;
+    result.cpuTimeExceeded = usage.cpuTimeExceeded;
+    result.memoryExceeded = usage.memoryExceeded;
+    result.maxResident = usage.maxResident;
+    result.minorFaults = usage.minorFaults;
+    result.majorFaults = usage.majorFaults;
+    result.voluntarySwitches = usage.voluntarySwitches;
+    result.involuntarySwitches = usage.involuntarySwitches;
+    result.readChars = usage.readChars;
+    result.writeChars = usage.writeChars;
+    result.readBytes = usage.readBytes;
+    result.writeBytes = usage.writeBytes;
+    result.readCalls = usage.readCalls;
+    result.writeCalls = usage.writeCalls;
+    result.readOps = usage.readOps;
+    result.writeOps = usage.writeOps;
+    result.output = usage.output;
+    result.outputExceeded = usage.outputExceeded;
+    result.answer = usage.answer;
+    return result;
+}
+
+std::future<SandboxResult> Sandbox::waitAsync()
+{
+    return std::async(std::launch::async, [this] { return wait(); });
+}
+
+std::future<void> Sandbox::waitAsync(std::function<void(const SandboxResult &)> callback)
+{
+    return std::async(std::launch::async, [this, callback = std::move(callback)] { callback(wait()); });
+}
+
+int Sandbox::pid() const noexcept
+{
+    return state_->launched ? state_->process.pid : -1;
+}
+} // namespace bsdbx
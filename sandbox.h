@@ -0,0 +1,154 @@
+#ifndef SANDBOX_H
+#define SANDBOX_H
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bsdbx
+{
+
+/**
+ * @brief The settings of a sandbox embedded in another program, the counterpart of the command line options.
+ */
+struct SandboxConfig
+{
+    std::vector<std::string> command{};     // The command to run, the first item is the executable
+    std::vector<std::string> environment{}; // The environment of the command as NAME=VALUE, empty to inherit ours
+    bool mode = 0;                          // 0 for runner, 1 for compiler
+    int timeLimit = 0;                      // Wall time limit in miliseconds, 0 means unlimited
+    int cpuTimeLimit = 0;                   // CPU time limit in miliseconds, 0 means unlimited
+    int memoryLimit = 0;                    // Memory limit in KB, 0 means unlimited
+    int taskLimit = 0;                      // Maximum number of processes and threads, 0 means unlimited
+    int ioBandwidthLimit = 0;               // Read and write bandwidth limit on every disk in KB/s, 0 means unlimited
+    int ioOpsLimit = 0;                     // Read and write operations per second on every disk, 0 means unlimited
+    int outputLimit = 0;                    // Limit of the standard output in KB, 0 means unlimited
+    std::string expectedFile{};             // File to compare the standard output against, empty for none
+    std::string compareMode = "token";      // How the output is compared: "exact", "token" or "float"
+    double floatTolerance = 1e-6;           // Absolute or relative tolerance of the float comparison
+    int sampleInterval = 1000;              // Memory sampling interval in microseconds
+    std::string timeline{};                 // CSV file to write the memory timeline of the run to, empty for none
+    int timelineInterval = 1000;            // Interval between two samples of the timeline in microseconds
+    std::string allowRead{};                // Colon-separated paths the command may read, empty for the default
+    std::string allowWrite{};               // Colon-separated paths the command may write, empty for the default
+    int scratch = 0;                        // Size of the tmpfs scratch directory of a compiler in KB, 0 for none
+    std::string cgroup{};                   // Delegated cgroup v2 under which the run gets a cgroup, empty for none
+    int slots = 0;                          // Number of cgroups recycled across runs, 0 for a new cgroup per run
+    std::string filterCache{};              // Directory of the compiled seccomp filter cache, empty for none
+    bool liveStats = false;                 // Whether to publish the run to the live statistics segment, or fail
+    int stdinFd = -1;                       // Standard input of the command, -1 to inherit ours
+    int stdoutFd = -1;                      // Standard output of the command, -1 to inherit ours
+    int stderrFd = -1;                      // Standard error of the command, -1 to inherit ours
+};
+
+/**
+ * @brief The outcome of a sandboxed run.
+ */
+struct SandboxResult
+{
+    std::string verdict{};        // "OK", "RE", "TLE", "MLE", "OLE" or "WA"
+    int exitCode = 0;             // The exit code of the command, or -1 if a limit was exceeded or it was killed
+    int status = 0;               // The wait status of the command
+    long long time = 0;           // Wall time in microseconds
+    long long userTime = 0;       // User CPU time in microseconds
+    long long systemTime = 0;     // System CPU time in microseconds
+    long memory = 0;              // Peak resident memory in KB
+    bool timeExceeded = false;    // Whether the command was killed for exceeding the wall time limit
+    bool cpuTimeExceeded = false; // Whether the command was killed for exceeding the CPU time limit
+    bool memoryExceeded = false;  // Whether the command was killed for exceeding the memory limit
+    long maxResident = 0;         // Peak resident set of the command as reported by the kernel in KB
+    long minorFaults = 0;         // Page faults served without I/O
+    long majorFaults = 0;         // Page faults which required I/O
+    long voluntarySwitches = 0;   // Context switches because the command waited for a resource
+    long involuntarySwitches = 0; // Context switches because the time slice of the command ran out
+    long long readChars = -1;     // Bytes passed to read-like calls, -1 if unknown
+    long long writeChars = -1;    // Bytes passed to write-like calls, -1 if unknown
+    long long readBytes = -1;     // Bytes fetched from the storage layer, -1 if unknown
+    long long writeBytes = -1;    // Bytes sent to the storage layer, -1 if unknown
+    long long readCalls = -1;     // Read-like system calls, -1 if unknown
+    long long writeCalls = -1;    // Write-like system calls, -1 if unknown
+    long long readOps = -1;       // Read operations issued to the storage devices, -1 if unknown
+    long long writeOps = -1;      // Write operations issued to the storage devices, -1 if unknown
+    long long output = -1;        // Size of the standard output in bytes, -1 if there is no output limit
+    bool outputExceeded = false;  // Whether the command was killed for exceeding the output limit
+    int answer = -1;              // 1 if the output matched the expected output, 0 if not, -1 if it was not compared
+};
+
+/**
+ * @brief Runs one command under the sandbox from within another program.
+ *
+ * The command is started by launch() and supervised by wait(), waitAsync() or the destructor, which kills it if it is
+ * still running. A sandbox runs its command once, create one sandbox per run; any number of them may run at the same
+ * time from different threads. The sandbox must outlive the asynchronous waits on it.
+ *
+ *     bsdbx::SandboxConfig config;
+ *     config.command = {"./solution"};
+ *     config.timeLimit = 1000;
+ *     bsdbx::Sandbox sandbox(config);
+ *     sandbox.launch();
+ *     auto result = sandbox.wait();
+ */
+class Sandbox
+{
+  public:
+    explicit Sandbox(SandboxConfig config);
+    Sandbox(const Sandbox &) = delete;
+    Sandbox &operator=(const Sandbox &) = delete;
+    ~Sandbox();
+
+    /**
+     * @brief Starts the command, and returns without waiting for it.
+     *
+     * @throw std::logic_error If the command was already started.
+     * @throw std::invalid_argument If the command is empty or the comparison mode is unknown.
+     * @throw std::runtime_error If the filter cannot be prepared or the command cannot be started.
+     */
+    void launch();
+
+    /**
+     * @brief Supervises the command until it exits and returns the outcome of the run.
+     *
+     * @throw std::logic_error If the command was not started or was already waited for.
+     * @throw std::runtime_error If the supervisor cannot be set up, in which case the command is killed.
+     */
+    SandboxResult wait();
+
+    /**
+     * @brief Supervises the command on a thread of its own.
+     *
+     * @return A future which receives the outcome of the run, or the exception thrown by wait().
+     */
+    std::future<SandboxResult> waitAsync();
+
+    /**
+     * @brief Supervises the command on a thread of its own, and calls a function with the outcome of the run.
+     *
+     * @param callback The function to call on the supervising thread once the command exits.
+     * @return A future which becomes ready after the callback returns, or receives the exception thrown by wait().
+     */
+    std::future<void> waitAsync(std::function<void(const SandboxResult &)> callback);
+
+    /**
+     * @brief Returns the process ID of the command, or -1 if it was not started.
+     */
+    int pid() const noexcept;
+
+  private:
+    struct State;
+    std::unique_ptr<State> state_;
+};
+
+/**
+ * @brief Runs a command under the sandbox and waits for it.
+ */
+inline SandboxResult runSandbox(SandboxConfig config)
+{
+    Sandbox sandbox(std::move(config));
+    sandbox.launch();
+    return sandbox.wait();
+}
+} // namespace bsdbx
+
+#endif // SANDBOX_H
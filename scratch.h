@@ -0,0 +1,157 @@
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mount.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace bsdbx
+{
+
+/**
+ * @brief A private scratch directory of a compiler run, backed by a tmpfs capped at a quota.
+ *
+ * The directory is created by the supervisor before the fork and passed to the command as TMPDIR, so the temporary
+ * files of a compiler stay in memory, and a runaway compilation fails with ENOSPC instead of filling the disk. The
+ * pages of the tmpfs are charged to the cgroup of the run, if any.
+ *
+ * A privileged supervisor mounts the tmpfs itself. Otherwise the child mounts it in a user and mount namespace of its
+ * own, which disappears with the command. A child which fails half way would run with an unmapped identity, so the
+ * namespace is first set up in a forked helper, once per process, and the scratch directory is not created if neither
+ * is possible, e.g. with unprivileged user namespaces disabled.
+ */
+class Scratch
+{
+  public:
+    Scratch() = default;
+    Scratch(const Scratch &) = delete;
+    Scratch &operator=(const Scratch &) = delete;
+
+    /**
+     * @brief Unmounts the tmpfs and removes the directory with whatever the command left in it.
+     */
+    ~Scratch()
+    {
+        if (path_.empty())
+        {
+            return;
+        }
+        if (mounted_)
+        {
+            umount2(path_.c_str(), MNT_DETACH);
+        }
+        nftw(
+            path_.c_str(),
+            [](const char *path, const struct stat *, int type, FTW *) {
+                return type == FTW_DP ? rmdir(path) : unlink(path);
+            },
+            16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    /**
+     * @brief Creates the directory, and mounts the tmpfs if the supervisor is allowed to.
+     *
+     * @param quota The size of the tmpfs in KB.
+     * @return Returns 0 on success, or -1 on failure with errno set, e.g. EPERM if the tmpfs can be mounted neither by
+     * the supervisor nor in a namespace of the child.
+     */
+    int create(int quota) noexcept
+    {
+        char path[] = "/tmp/bsdbx-scratch-XXXXXX";
+        if (mkdtemp(path) == nullptr)
+        {
+            return -1;
+        }
+        path_ = path;
+        snprintf(data_, sizeof(data_), "size=%dk,mode=0700", quota);
+        mounted_ = mount("tmpfs", path, "tmpfs", MS_NOSUID | MS_NODEV, data_) == 0;
+
+        // The identity maps of the namespace of the child, which may not allocate.
+        snprintf(uidMap_, sizeof(uidMap_), "%d %d 1\n", (int)getuid(), (int)getuid());
+        snprintf(gidMap_, sizeof(gidMap_), "%d %d 1\n", (int)getgid(), (int)getgid());
+        if (!mounted_ && !probe())
+        {
+            errno = EPERM;
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Mounts the tmpfs in the child if the supervisor could not, only making async-signal-safe calls.
+     *
+     * create() made sure that the namespace can be set up, a failure here fails the run.
+     *
+     * @return Returns 0 on success, or -1 on failure with errno set.
+     */
+    int enter() const noexcept
+    {
+        return mounted_ ? 0 : mountPrivately();
+    }
+
+    /**
+     * @brief Returns the path of the directory.
+     */
+    const std::string &path() const noexcept
+    {
+        return path_;
+    }
+
+  private:
+    int mountPrivately() const noexcept
+    {
+        if (unshare(CLONE_NEWUSER | CLONE_NEWNS) < 0 || writeFile("/proc/self/setgroups", "deny") < 0 ||
+            writeFile("/proc/self/uid_map", uidMap_) < 0 || writeFile("/proc/self/gid_map", gidMap_) < 0 ||
+            mount("tmpfs", path_.c_str(), "tmpfs", MS_NOSUID | MS_NODEV, data_) < 0)
+        {
+            return -1;
+        }
+        return 0;
+    }
+
+    // Sets the namespace up in a helper, which throws it away. The outcome does not change during the life of the
+    // process, so it is only probed once.
+    bool probe() const noexcept
+    {
+        static const bool possible = [this] {
+            auto pid = fork();
+            if (pid == 0)
+            {
+                _exit(mountPrivately() == 0 ? 0 : 1);
+            }
+            int status;
+            return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }();
+        return possible;
+    }
+
+    static int writeFile(const char *path, const char *content) noexcept
+    {
+        int fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        auto size = (ssize_t)strlen(content);
+        bool written = write(fd, content, size) == size;
+        close(fd);
+        return written ? 0 : -1;
+    }
+
+    std::string path_;
+    bool mounted_ = false;
+    char data_[64];
+    char uidMap_[32];
+    char gidMap_[32];
+};
+} // namespace bsdbx
+
+#endif // SCRATCH_H
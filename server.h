@@ -0,0 +1,278 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "filter.h"
+#include "options.h"
+#include "run.h"
+#include <errno.h>
+#include <exception>
+#include <signal.h>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace bsdbx
+{
+
+/**
+ * @brief The largest job description accepted by the server.
+ */
+constexpr size_t MAX_JOB_SIZE = 64 * 1024;
+
+/**
+ * @brief Runs one job received by the server and builds its reply.
+ *
+ * @param server The options of the server.
+ * @param job The arguments of the job, separated by NUL characters.
+ * @param stdio The standard input, output and error received with the job, -1 for the ones not sent.
+ * @param filters The prepared filters of the runner and the compiler mode.
+ * @param pinned The fixed address the runner filter expects the name of the executable at.
+ * @param envp The environment of the command.
+ * @return The reply to send back.
+ */
+inline std::string serveJob(const Options &server, const std::string &job, const int stdio[3], Filter *filters[2],
+                            char *pinned, char **envp)
+{
+    std::vector<std::string> words{"bsdbx"};
+    for (size_t pos = 0; pos < job.size();)
+    {
+        auto end = job.find('\0', pos);
+        if (end == std::string::npos)
+        {
+            end = job.size();
+        }
+        words.push_back(job.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    std::vector<char *> argv;
+    for (auto &word : words)
+    {
+        argv.push_back(word.data());
+    }
+
+    try
+    {
+        auto options = parseOptions(argv.size(), argv.data());
+        if (options.args.size() < 2)
+        {
+            throw std::invalid_argument("No executable file");
+        }
+        // The isolation of the jobs is a decision of the server, not of its clients.
+        options.cgroup = server.cgroup;
+        options.slots = server.slots;
+        options.allowRead = server.allowRead;
+        options.allowWrite = server.allowWrite;
+        options.filterCache = server.filterCache;
+
+        // The server would open these paths with its own privileges on behalf of the client, which may pass open
+        // files instead. A job is also a single run of a single command, which the server reports the usage of, so
+        // the options which would run or report anything else are refused rather than ignored.
+        std::pair<bool, const char *> forbidden[] = {
+            {!options.stdinFile.empty(), "--stdin"},
+            {!options.stdoutFile.empty(), "--stdout"},
+            {!options.expectedFile.empty(), "--expected"},
+            {!options.timeline.empty(), "--timeline"},
+            {!options.resultFile.empty(), "--result-file"},
+            {!options.compileCache.empty(), "--compile-cache"},
+            {options.scratch > 0, "--scratch"},
+            {options.resultFd >= 0, "--result-fd"},
+            {!options.interactor.empty(), "--interactor"},
+            {options.repeat > 0, "--repeat"},
+            {options.warmup > 0, "--warmup"},
+            {options.profileSyscalls, "--profile-syscalls"},
+            {options.phaseTiming, "--phase-timing"},
+            {!options.batch.empty(), "--batch"},
+            {!options.batchResult.empty(), "--batch-result"},
+            {options.jobs > 0, "--jobs"},
+            {options.failFast, "--fail-fast"},
+            {!options.warmCache.empty(), "--warm-seccomp-cache"},
+            {!options.serve.empty(), "--serve"},
+        };
+        for (auto &[given, name] : forbidden)
+        {
+            if (given)
+            {
+                throw std::invalid_argument(std::string(name) + " is not accepted in a job");
+            }
+        }
+
+        const char *executable = options.args[0];
+        if (!options.mode)
+        {
+            if (strlen(executable) >= PATH_MAX)
+            {
+                throw std::invalid_argument("Executable path too long");
+            }
+            strcpy(pinned, executable);
+            executable = pinned;
+        }
+
+        auto usage = run(options, *filters[options.mode], executable, envp, stdio);
+        std::ostringstream reply;
+        printUsage(reply, usage);
+        reply << exitCode(usage) << std::endl;
+        return reply.str();
+    }
+    catch (const std::exception &e)
+    {
+        return std::string("error ") + e.what() + "\n";
+    }
+}
+
+/**
+ * @brief Serves the jobs of one client until it disconnects.
+ */
+inline void serveClient(const Options &server, int connection, Filter *filters[2], char *pinned, char **envp)
+{
+    std::string job(MAX_JOB_SIZE, '\0');
+    while (true)
+    {
+        alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))];
+        iovec vector{job.data(), job.size()};
+        msghdr message{};
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        auto n = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+        if (n <= 0)
+        {
+            return;
+        }
+
+        int stdio[3] = {-1, -1, -1};
+        int count = 0;
+        for (auto header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+        {
+            if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+            {
+                int received = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (int i = 0; i < received; i++)
+                {
+                    int fd;
+                    memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+                    if (count < 3)
+                    {
+                        stdio[count++] = fd;
+                    }
+                    else
+                    {
+                        close(fd);
+                    }
+                }
+            }
+        }
+
+        std::string reply;
+        if (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+        {
+            reply = "error Job description too large\n";
+        }
+        else
+        {
+            reply = serveJob(server, job.substr(0, n), stdio, filters, pinned, envp);
+        }
+        for (int fd : stdio)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+        if (send(connection, reply.data(), reply.size(), MSG_NOSIGNAL) < 0)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Serves sandbox jobs on a Unix domain socket, never returning unless the socket cannot be set up.
+ *
+ * The filters of both modes are prepared once, so a job only costs the fork of the command. Every client connection
+ * is served by a forked worker, which runs the jobs of the connection one after the other.
+ *
+ * The socket is a SOCK_SEQPACKET socket. A job is a single message made of the arguments of the job separated by NUL
+ * characters, with the same syntax as the command line of the sandbox, e.g. "/bin/a\0--time-limit=1000". The
+ * standard input, output and error of the command may be passed along with SCM_RIGHTS, in this order. The reply is
+ * a single message holding the lines the sandbox prints for a run followed by its exit code, or "error" and a
+ * description of the problem. The options naming files the server would open for the client are rejected, and the
+ * socket is created with mode 0600.
+ *
+ * @param options The options of the server, of which the socket path, the cgroup, the Landlock paths and the
+ * filter cache are used.
+ * @param envp The environment of the commands.
+ * @throw std::runtime_error If the filters or the socket cannot be set up.
+ */
+inline void serve(const Options &options, char **envp)
+{
+    Filter runner, compiler;
+    Filter *filters[2] = {&runner, &compiler};
+    const char *pinned, *unused;
+    if (prepareFilter(runner, 0, options.filterCache, "", pinned) < 0 ||
+        prepareFilter(compiler, 1, options.filterCache, "", unused) < 0)
+    {
+        throw std::runtime_error("Failed to prepare the seccomp filter");
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (options.serve.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("Socket path too long");
+    }
+    strcpy(address.sun_path, options.serve.c_str());
+    int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    unlink(address.sun_path);
+    // Only the user of the server may connect until the socket is handed to others, e.g. with chgrp and chmod.
+    auto mask = umask(0177);
+    int bound = listener < 0 ? -1 : bind(listener, (sockaddr *)&address, sizeof(address));
+    umask(mask);
+    if (bound < 0 || listen(listener, 128) < 0)
+    {
+        throw std::runtime_error("Failed to listen on " + options.serve);
+    }
+
+    // The workers are reaped by the kernel.
+    signal(SIGCHLD, SIG_IGN);
+    while (true)
+    {
+        int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0 && (errno == EINTR || errno == ECONNABORTED))
+        {
+            continue;
+        }
+        else if (connection < 0 && (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM))
+        {
+            // The connection stays queued, retrying at once would spin until a worker exits and frees its share.
+            timespec backoff{0, 100000000};
+            nanosleep(&backoff, nullptr);
+            continue;
+        }
+        else if (connection < 0)
+        {
+            throw std::runtime_error("Failed to accept a connection on " + options.serve);
+        }
+        auto pid = fork();
+        if (pid == 0)
+        {
+            // The worker waits for the commands itself.
+            signal(SIGCHLD, SIG_DFL);
+            close(listener);
+            serveClient(options, connection, filters, (char *)pinned, envp);
+            _exit(0);
+        }
+        close(connection);
+    }
+}
+} // namespace bsdbx
+
+#endif // SERVER_H
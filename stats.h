@@ -0,0 +1,312 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <initializer_list>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace bsdbx
+{
+
+constexpr const char *LIVE_STATS_PREFIX = "/bsdbx-stats-"; // Prefix of the POSIX shared memory object of each user
+constexpr uint32_t LIVE_STATS_MAGIC = 0x62736478;          // "bsdx", set once the segment is initialized
+constexpr uint32_t LIVE_STATS_VERSION = 1;
+constexpr int LIVE_STATS_SLOTS = 256;  // Number of sandbox processes which can publish at the same time
+constexpr int LIVE_STATS_BUCKETS = 16; // Wall time buckets: bucket i counts the runs under 2^i ms, the last the rest
+
+/**
+ * @brief The verdicts counted by the live statistics, in the order of LiveSlot::verdicts.
+ */
+constexpr const char *LIVE_STATS_VERDICTS[] = {"OK", "RE", "TLE", "MLE", "OLE", "WA", "FAIL"};
+constexpr int LIVE_STATS_VERDICT_COUNT = sizeof(LIVE_STATS_VERDICTS) / sizeof(LIVE_STATS_VERDICTS[0]);
+
+/**
+ * @brief The counters of one sandbox process, updated with relaxed atomics and read without any lock.
+ *
+ * A slot is owned by the process whose ID is in pid, 0 if it is free. Its counters are cumulative since the slot was
+ * claimed, so a reader computes rates from the difference of two scrapes and treats a new owner as a reset.
+ */
+struct alignas(64) LiveSlot
+{
+    std::atomic<int32_t> pid;                                  // The process owning the slot, 0 if free
+    std::atomic<int32_t> running;                              // Commands being supervised right now
+    std::atomic<uint64_t> started;                             // Monotonic time of the claim in microseconds
+    std::atomic<uint64_t> updated;                             // Monotonic time of the last update in microseconds
+    std::atomic<uint64_t> runs;                                // Commands supervised to the end
+    std::atomic<uint64_t> verdicts[LIVE_STATS_VERDICT_COUNT];  // Runs per verdict
+    std::atomic<uint64_t> wallTime;                            // Total wall time of the runs in microseconds
+    std::atomic<uint64_t> cpuTime;                             // Total CPU time of the runs in microseconds
+    std::atomic<uint64_t> wallTimeBuckets[LIVE_STATS_BUCKETS]; // Histogram of the wall time of the runs
+    std::atomic<uint64_t> samples;                             // Memory samples taken
+    std::atomic<uint64_t> missedSamples;                       // Memory samples skipped because the sampler was late
+};
+
+/**
+ * @brief The layout of the shared memory segment.
+ */
+struct LiveStatsSegment
+{
+    std::atomic<uint32_t> magic; // LIVE_STATS_MAGIC once the header is initialized
+    uint32_t version;            // LIVE_STATS_VERSION
+    uint32_t slots;              // LIVE_STATS_SLOTS
+    uint32_t buckets;            // LIVE_STATS_BUCKETS
+    LiveSlot slot[LIVE_STATS_SLOTS];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<int32_t>::is_always_lock_free,
+              "The live statistics need lock-free atomics to be shared between processes");
+
+/**
+ * @brief Returns the bucket of the wall time histogram of a run.
+ *
+ * @param time The wall time in microseconds.
+ */
+inline int wallTimeBucket(long long time) noexcept
+{
+    int bucket = 0;
+    for (long long bound = 1000; bucket < LIVE_STATS_BUCKETS - 1 && time >= bound; bound *= 2)
+    {
+        bucket++;
+    }
+    return bucket;
+}
+
+/**
+ * @brief Returns the name of the live statistics segment of a user, e.g. /bsdbx-stats-1000.
+ */
+inline std::string liveStatsName(uid_t uid)
+{
+    return LIVE_STATS_PREFIX + std::to_string(uid);
+}
+
+/**
+ * @brief Maps the live statistics segment of a user, creating it if needed.
+ *
+ * Each user publishes to a segment of their own, so that no user can take the segment of the others over by creating
+ * it first. A writer only maps a segment owned by its effective user, which others may read but not write.
+ *
+ * @param writable Whether to map the segment of the effective user for writing, which also creates it.
+ * @param uid The user whose segment is read, ignored when writable.
+ * @return The segment, or nullptr on failure with errno set, e.g. ENOENT if no sandbox ever published to it.
+ */
+inline LiveStatsSegment *mapLiveStats(bool writable, uid_t uid = geteuid()) noexcept
+{
+    char name[32];
+    auto length = snprintf(name, sizeof(name), "%s%u", LIVE_STATS_PREFIX, writable ? geteuid() : uid);
+    if (length < 0 || length >= (int)sizeof(name))
+    {
+        errno = ENAMETOOLONG;
+        return nullptr;
+    }
+    int fd = shm_open(name, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    // Every process truncates the object to the same size, so a race between creators is harmless.
+    struct stat stat;
+    int error = 0;
+    if (fstat(fd, &stat) < 0)
+    {
+        error = errno;
+    }
+    else if (writable && stat.st_uid != geteuid())
+    {
+        error = EACCES;
+    }
+    else if (writable && (ftruncate(fd, sizeof(LiveStatsSegment)) < 0 || fstat(fd, &stat) < 0))
+    {
+        error = errno;
+    }
+    else if (stat.st_size < (off_t)sizeof(LiveStatsSegment))
+    {
+        error = EINVAL;
+    }
+    if (error != 0)
+    {
+        close(fd);
+        errno = error;
+        return nullptr;
+    }
+    auto address = mmap(nullptr, sizeof(LiveStatsSegment), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                        MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    auto segment = (LiveStatsSegment *)address;
+    if (writable && segment->magic.load(std::memory_order_acquire) != LIVE_STATS_MAGIC)
+    {
+        // A fresh object is zero-filled, the fields are the same for every writer.
+        segment->version = LIVE_STATS_VERSION;
+        segment->slots = LIVE_STATS_SLOTS;
+        segment->buckets = LIVE_STATS_BUCKETS;
+        segment->magic.store(LIVE_STATS_MAGIC, std::memory_order_release);
+    }
+    return segment;
+}
+
+/**
+ * @brief Publishes the activity of this sandbox process to the live statistics segment.
+ *
+ * The process claims a slot of its own the first time it publishes, and releases it when it exits. A slot whose
+ * owner died without releasing it is claimed again. Publishing only touches the mapped memory, so it costs a few
+ * atomic additions per run; if the segment cannot be mapped or is full, nothing is published and error() tells why.
+ */
+class LiveStats
+{
+  public:
+    LiveStats(const LiveStats &) = delete;
+    LiveStats &operator=(const LiveStats &) = delete;
+
+    /**
+     * @brief Returns the publisher of this process, which claims its slot when first used.
+     */
+    static LiveStats &instance() noexcept
+    {
+        static LiveStats stats;
+        return stats;
+    }
+
+    /**
+     * @brief Returns 0 if this process publishes, otherwise why it does not, e.g. EBUSY if every slot is taken.
+     */
+    int error() const noexcept
+    {
+        return error_;
+    }
+
+    /**
+     * @brief Counts a command which starts being supervised.
+     */
+    void begin() noexcept
+    {
+        if (slot_ != nullptr)
+        {
+            slot_->running.fetch_add(1, std::memory_order_relaxed);
+            touch();
+        }
+    }
+
+    /**
+     * @brief Counts a command whose supervision failed, and which is not supervised anymore.
+     */
+    void cancel() noexcept
+    {
+        if (slot_ != nullptr)
+        {
+            slot_->running.fetch_sub(1, std::memory_order_relaxed);
+            touch();
+        }
+    }
+
+    /**
+     * @brief Counts a command which was supervised to the end.
+     *
+     * @param verdict The index of the verdict of the run in LIVE_STATS_VERDICTS.
+     * @param time The wall time of the run in microseconds.
+     * @param cpuTime The user and system time of the run in microseconds.
+     * @param samples The memory samples taken during the run.
+     * @param missedSamples The memory samples skipped during the run.
+     */
+    void end(int verdict, long long time, long long cpuTime, long long samples, long long missedSamples) noexcept
+    {
+        if (slot_ == nullptr)
+        {
+            return;
+        }
+        slot_->running.fetch_sub(1, std::memory_order_relaxed);
+        slot_->runs.fetch_add(1, std::memory_order_relaxed);
+        slot_->verdicts[verdict].fetch_add(1, std::memory_order_relaxed);
+        slot_->wallTime.fetch_add(time, std::memory_order_relaxed);
+        slot_->cpuTime.fetch_add(cpuTime, std::memory_order_relaxed);
+        slot_->wallTimeBuckets[wallTimeBucket(time)].fetch_add(1, std::memory_order_relaxed);
+        slot_->samples.fetch_add(samples, std::memory_order_relaxed);
+        slot_->missedSamples.fetch_add(missedSamples, std::memory_order_relaxed);
+        touch();
+    }
+
+  private:
+    LiveStats() noexcept
+    {
+        segment_ = mapLiveStats(true);
+        if (segment_ == nullptr)
+        {
+            error_ = errno;
+            return;
+        }
+        int32_t pid = getpid();
+        for (int i = 0; i < LIVE_STATS_SLOTS && slot_ == nullptr; i++)
+        {
+            auto &slot = segment_->slot[i];
+            int32_t owner = slot.pid.load(std::memory_order_relaxed);
+            bool dead = owner != 0 && kill(owner, 0) < 0 && errno == ESRCH;
+            if ((owner == 0 || dead) && slot.pid.compare_exchange_strong(owner, pid))
+            {
+                slot_ = &slot;
+            }
+        }
+        if (slot_ == nullptr)
+        {
+            error_ = EBUSY;
+            return;
+        }
+        slot_->running.store(0, std::memory_order_relaxed);
+        for (auto counter : {&slot_->runs, &slot_->wallTime, &slot_->cpuTime, &slot_->samples, &slot_->missedSamples})
+        {
+            counter->store(0, std::memory_order_relaxed);
+        }
+        for (auto &counter : slot_->verdicts)
+        {
+            counter.store(0, std::memory_order_relaxed);
+        }
+        for (auto &counter : slot_->wallTimeBuckets)
+        {
+            counter.store(0, std::memory_order_relaxed);
+        }
+        slot_->started.store(now(), std::memory_order_relaxed);
+        touch();
+    }
+
+    ~LiveStats()
+    {
+        if (slot_ != nullptr)
+        {
+            slot_->running.store(0, std::memory_order_relaxed);
+            slot_->pid.store(0, std::memory_order_release);
+        }
+        if (segment_ != nullptr)
+        {
+            munmap(segment_, sizeof(LiveStatsSegment));
+        }
+    }
+
+    static uint64_t now() noexcept
+    {
+        timespec spec;
+        clock_gettime(CLOCK_MONOTONIC, &spec);
+        return spec.tv_sec * 1000000ULL + spec.tv_nsec / 1000;
+    }
+
+    void touch() noexcept
+    {
+        slot_->updated.store(now(), std::memory_order_relaxed);
+    }
+
+    LiveStatsSegment *segment_ = nullptr;
+    int error_ = 0;
+    LiveSlot *slot_ = nullptr;
+};
+} // namespace bsdbx
+
+#endif // STATS_H
@@ -0,0 +1,67 @@
+#include "cache.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <utility>
+
+// Checks the SHA-256 which names the compile cache entries against the vectors of FIPS 180-2, and lengths around the
+// padding boundary of a block.
+
+static int failures = 0;
+
+static void expect(const std::string &name, const std::string &actual, const std::string &expected)
+{
+    if (actual != expected)
+    {
+        std::cerr << name << ": expected " << expected << ", got " << actual << std::endl;
+        failures++;
+    }
+}
+
+// Hashes the data in chunks of the given size, so that the blocks are filled across several updates.
+static std::string hash(const std::string &data, size_t chunk)
+{
+    bsdbx::Sha256 sha;
+    for (size_t i = 0; i < data.size(); i += chunk)
+    {
+        sha.update(data.data() + i, std::min(chunk, data.size() - i));
+    }
+    return sha.hex();
+}
+
+int main()
+{
+    const std::pair<std::string, const char *> vectors[] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {std::string(55, 'a'), "9f4390f8d30c2dd92ec9f095b65e2b9ae9b0a925a5258e241c9f1e910f734318"},
+        {std::string(56, 'a'), "b35439a4ac6f0948b6d6f9e3c6af0f5f590ce20f1bde7090ef7970686ec6738a"},
+        {std::string(63, 'a'), "7d3e74a05d7db15bce4ad9ec0658ea98e3f06eeecf16b4c6fff2da457ddc2f34"},
+        {std::string(64, 'a'), "ffe054fe7ae0cb6dc65c3af9b61d5209f439851db43d0ba5997337df154668eb"},
+        {std::string(65, 'a'), "635361c48bb9eab14198e76ea8ab7f1a41685d6ad62aa9146d301d4f17eb0ae0"},
+        {std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    };
+    for (auto &[data, digest] : vectors)
+    {
+        for (size_t chunk : {(size_t)1, (size_t)63, (size_t)997, data.size() + 1})
+        {
+            expect("length " + std::to_string(data.size()) + " chunk " + std::to_string(chunk), hash(data, chunk),
+                   digest);
+        }
+    }
+
+    // Strings are hashed with their NUL, so that "ab" + "c" and "a" + "bc" differ.
+    bsdbx::Sha256 first, second;
+    first.update(std::string("ab"));
+    first.update(std::string("c"));
+    second.update(std::string("a"));
+    second.update(std::string("bc"));
+    if (first.hex() == second.hex())
+    {
+        std::cerr << "consecutive strings run into each other" << std::endl;
+        failures++;
+    }
+    return failures == 0 ? 0 : 1;
+}
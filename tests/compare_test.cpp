@@ -0,0 +1,139 @@
+#include "compare.h"
+#include <algorithm>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Checks that every scanning kernel agrees with the scalar one, and the results of OutputComparator in every mode
+// whatever the size of the chunks the output is fed in.
+
+static int failures = 0;
+
+static void expect(const std::string &name, long long actual, long long expected)
+{
+    if (actual != expected)
+    {
+        std::cerr << name << ": expected " << expected << ", got " << actual << std::endl;
+        failures++;
+    }
+}
+
+static void checkKernels(const char *name, const bsdbx::ScanKernels &kernels)
+{
+    // Lengths around the 16 and 32 byte blocks, so that every position of a block and of the tail is covered.
+    const size_t lengths[] = {0, 1, 15, 16, 17, 31, 32, 33, 47, 63, 64, 65, 100};
+    // Every whitespace, and the bytes next to them or which compare differently as signed and unsigned.
+    const char spaces[] = {' ', '\t', '\n', '\v', '\f', '\r'};
+    const char others[] = {'a', '\x08', '\x0e', '\x1f', '!', '\x89', '\xa0', '\xff'};
+    for (auto n : lengths)
+    {
+        std::string a(n, 'x');
+        expect(std::string(name) + " mismatch equal n=" + std::to_string(n),
+               kernels.mismatch(a.data(), a.data(), n), n);
+        for (size_t k = 0; k < n; k++)
+        {
+            auto b = a;
+            b[k] = 'y';
+            auto label = std::string(name) + " n=" + std::to_string(n) + " k=" + std::to_string(k);
+            expect(label + " mismatch", kernels.mismatch(a.data(), b.data(), n),
+                   bsdbx::mismatchScalar(a.data(), b.data(), n));
+            for (auto c : spaces)
+            {
+                std::string word(n, 'a');
+                word[k] = c;
+                expect(label + " findSpace", kernels.findSpace(word.data(), n),
+                       bsdbx::findSpaceScalar(word.data(), n));
+            }
+            for (auto c : others)
+            {
+                std::string word(n, 'a');
+                word[k] = c;
+                expect(label + " findSpace other", kernels.findSpace(word.data(), n),
+                       bsdbx::findSpaceScalar(word.data(), n));
+                std::string blank(n, ' ');
+                blank[k] = c;
+                expect(label + " skipSpace", kernels.skipSpace(blank.data(), n),
+                       bsdbx::skipSpaceScalar(blank.data(), n));
+            }
+        }
+        std::string word(n, 'a'), blank(n, '\n');
+        expect(std::string(name) + " findSpace none n=" + std::to_string(n), kernels.findSpace(word.data(), n), n);
+        expect(std::string(name) + " skipSpace all n=" + std::to_string(n), kernels.skipSpace(blank.data(), n), n);
+    }
+}
+
+static void checkComparison(bsdbx::CompareMode mode, const std::string &expected, const std::string &output,
+                            bsdbx::OutputComparator::Result result)
+{
+    char path[] = "/tmp/bsdbx-compare-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, expected.data(), expected.size()) != (ssize_t)expected.size())
+    {
+        std::cerr << "Failed to write the expected output" << std::endl;
+        failures++;
+        return;
+    }
+    close(fd);
+    // Every chunk size splits the tokens and the whitespace at other places.
+    for (size_t chunk : {(size_t)1, (size_t)2, (size_t)7, (size_t)33, output.size() + 1})
+    {
+        bsdbx::OutputComparator comparator;
+        if (comparator.open(path, mode, 1e-6) < 0)
+        {
+            std::cerr << "Failed to open the expected output" << std::endl;
+            failures++;
+            break;
+        }
+        for (size_t i = 0; i < output.size(); i += chunk)
+        {
+            comparator.feed(output.data() + i, std::min(chunk, output.size() - i));
+        }
+        expect("mode " + std::to_string((int)mode) + " expected \"" + expected + "\" output \"" + output +
+                   "\" chunk " + std::to_string(chunk),
+               comparator.finish(), result);
+    }
+    unlink(path);
+}
+
+int main()
+{
+    checkKernels("scalar", {bsdbx::mismatchScalar, bsdbx::findSpaceScalar, bsdbx::skipSpaceScalar});
+#if defined(__x86_64__)
+    checkKernels("sse2", {bsdbx::mismatchSse2, bsdbx::findSpaceSse2, bsdbx::skipSpaceSse2});
+    if (__builtin_cpu_supports("avx2"))
+    {
+        checkKernels("avx2", {bsdbx::mismatchAvx2, bsdbx::findSpaceAvx2, bsdbx::skipSpaceAvx2});
+    }
+#endif
+
+    using bsdbx::CompareMode;
+    using Result = bsdbx::OutputComparator;
+    std::string block(100, 'z');
+
+    checkComparison(CompareMode::EXACT, "1 2\n", "1 2\n", Result::MATCH);
+    checkComparison(CompareMode::EXACT, "1 2\n", "1 3\n", Result::MISMATCH);
+    checkComparison(CompareMode::EXACT, "1 2\n", "1 2\n\n", Result::MISMATCH);
+    checkComparison(CompareMode::EXACT, "1 2\n", "1 ", Result::TRUNCATED);
+    checkComparison(CompareMode::EXACT, block, block, Result::MATCH);
+    checkComparison(CompareMode::EXACT, block, block.substr(0, 64) + "y" + block.substr(65), Result::MISMATCH);
+    checkComparison(CompareMode::EXACT, "", "", Result::MATCH);
+
+    checkComparison(CompareMode::TOKEN, "1  2\n", "1 2", Result::MATCH);
+    checkComparison(CompareMode::TOKEN, "1 2", "\n1\t2 \n\n  ", Result::MATCH);
+    checkComparison(CompareMode::TOKEN, "1 2\n", "1 3\n", Result::MISMATCH);
+    checkComparison(CompareMode::TOKEN, "1 2\n", "12\n", Result::MISMATCH);
+    checkComparison(CompareMode::TOKEN, "1 2\n", "1 2 3\n", Result::MISMATCH);
+    checkComparison(CompareMode::TOKEN, "1 23\n", "1 2", Result::TRUNCATED);
+    checkComparison(CompareMode::TOKEN, "1 2\n", "1\n", Result::TRUNCATED);
+    checkComparison(CompareMode::TOKEN, block + " " + block, block + "\n" + block + "\n", Result::MATCH);
+
+    checkComparison(CompareMode::FLOAT, "1.0 2.5\n", "1.0000001 2.5", Result::MATCH);
+    checkComparison(CompareMode::FLOAT, "1.0 2.5\n", "1 2.5000001\n\n", Result::MATCH);
+    checkComparison(CompareMode::FLOAT, "1000000\n", "1000000.5\n", Result::MATCH);
+    checkComparison(CompareMode::FLOAT, "1.0 2.5\n", "1.00001 2.5", Result::MISMATCH);
+    checkComparison(CompareMode::FLOAT, "1.0 abc\n", "1.0 abd", Result::MISMATCH);
+    checkComparison(CompareMode::FLOAT, "1.0 2.5\n", "1.0\n", Result::TRUNCATED);
+    return failures == 0 ? 0 : 1;
+}
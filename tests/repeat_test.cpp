@@ -0,0 +1,40 @@
+#include "repeat.h"
+#include <iostream>
+#include <vector>
+
+// Checks the nearest-rank percentiles of summarize() on sample counts where p * n is an integer.
+
+static int failures = 0;
+
+static void expect(const char *name, double actual, double expected)
+{
+    if (actual != expected)
+    {
+        std::cerr << name << ": expected " << expected << ", got " << actual << std::endl;
+        failures++;
+    }
+}
+
+int main()
+{
+    // Shuffled, so that the samples are sorted by summarize().
+    auto ten = bsdbx::summarize({7, 3, 10, 1, 9, 5, 2, 8, 4, 6});
+    expect("n=10 min", ten.min, 1);
+    expect("n=10 median", ten.median, 5);
+    expect("n=10 p90", ten.p90, 9);
+    expect("n=10 mean", ten.mean, 5.5);
+
+    auto two = bsdbx::summarize({20, 10});
+    expect("n=2 min", two.min, 10);
+    expect("n=2 median", two.median, 10);
+    expect("n=2 p90", two.p90, 20);
+
+    auto one = bsdbx::summarize({42});
+    expect("n=1 median", one.median, 42);
+    expect("n=1 p90", one.p90, 42);
+
+    auto three = bsdbx::summarize({3, 1, 2});
+    expect("n=3 median", three.median, 2);
+    expect("n=3 p90", three.p90, 3);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <memory>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+
+namespace bsdbx
+{
+
+/**
+ * @brief Records how the memory, page faults and CPU time of a run evolve, to tell a slow leak from a single large
+ * allocation.
+ *
+ * The samples are kept in a ring buffer allocated before the run, so that the latest samples survive however long
+ * the run is. Taking a sample never allocates: it reads /proc/<pid>/stat through a descriptor kept open for the whole
+ * run and the CPU clock of the process. Only the command itself is recorded, not its children.
+ */
+class TimelineRecorder
+{
+  public:
+    /**
+     * @brief One sample of the timeline.
+     */
+    struct Sample
+    {
+        long long time;    // Wall time since the start of the run in microseconds
+        long resident;     // Resident memory in KB
+        long minorFaults;  // Page faults served without I/O so far
+        long majorFaults;  // Page faults which required I/O so far
+        long long cpuTime; // CPU time so far in microseconds
+    };
+
+    TimelineRecorder() = default;
+    TimelineRecorder(const TimelineRecorder &) = delete;
+    TimelineRecorder &operator=(const TimelineRecorder &) = delete;
+
+    ~TimelineRecorder()
+    {
+        detach();
+        if (output_ >= 0)
+        {
+            close(output_);
+        }
+    }
+
+    /**
+     * @brief Creates the file of the timeline and allocates the ring buffer.
+     *
+     * @param path The CSV file to write the timeline to.
+     * @param capacity The number of samples kept.
+     * @param interval The interval between two samples in microseconds.
+     * @return Returns 0 on success, or -1 on failure.
+     */
+    int open(const std::string &path, size_t capacity, int interval) noexcept
+    {
+        interval_ = interval > 0 ? interval : 1000;
+        samples_ = std::unique_ptr<Sample[]>(new (std::nothrow) Sample[capacity > 0 ? capacity : 1]);
+        capacity_ = capacity > 0 ? capacity : 1;
+        output_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        return samples_ == nullptr || output_ < 0 ? -1 : 0;
+    }
+
+    /**
+     * @brief The interval between two samples in microseconds.
+     */
+    int interval() const noexcept
+    {
+        return interval_;
+    }
+
+    /**
+     * @brief Starts recording a process.
+     *
+     * @param pid The process to record.
+     * @param start The value of the monotonic clock in microseconds when the process was started.
+     * @return Returns 0 on success, or -1 if the process cannot be read.
+     */
+    int attach(int pid, long long start) noexcept
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+        stat_ = ::open(path, O_RDONLY | O_CLOEXEC);
+        hasCpuClock_ = clock_getcpuclockid(pid, &cpuClock_) == 0;
+        start_ = start;
+        return stat_ < 0 ? -1 : 0;
+    }
+
+    /**
+     * @brief Stops recording, once the process has exited.
+     */
+    void detach() noexcept
+    {
+        if (stat_ >= 0)
+        {
+            close(stat_);
+            stat_ = -1;
+        }
+    }
+
+    /**
+     * @brief Takes a sample, overwriting the oldest one if the buffer is full.
+     */
+    void record() noexcept
+    {
+        static const long PAGE_SIZE = sysconf(_SC_PAGESIZE);
+        char buffer[1024];
+        auto n = stat_ < 0 ? -1 : pread(stat_, buffer, sizeof(buffer) - 1, 0);
+        if (n <= 0)
+        {
+            return;
+        }
+        buffer[n] = '\0';
+        // minflt, majflt and rss are the fields 10, 12 and 24, after the name which may contain anything.
+        auto name = strrchr(buffer, ')');
+        Sample sample{};
+        if (name == nullptr || sscanf(name + 1,
+                                      " %*c %*d %*d %*d %*d %*d %*u %ld %*u %ld %*u %*u %*u %*d %*d %*d %*d %*d %*d "
+                                      "%*u %*u %ld",
+                                      &sample.minorFaults, &sample.majorFaults, &sample.resident) != 3)
+        {
+            return;
+        }
+        timespec spec;
+        clock_gettime(CLOCK_MONOTONIC, &spec);
+        sample.time = spec.tv_sec * 1000000LL + spec.tv_nsec / 1000 - start_;
+        sample.resident = sample.resident * PAGE_SIZE / 1024;
+        if (hasCpuClock_ && clock_gettime(cpuClock_, &spec) == 0)
+        {
+            sample.cpuTime = spec.tv_sec * 1000000LL + spec.tv_nsec / 1000;
+        }
+        samples_[(first_ + size_) % capacity_] = sample;
+        if (size_ < capacity_)
+        {
+            size_++;
+        }
+        else
+        {
+            first_ = (first_ + 1) % capacity_;
+        }
+    }
+
+    /**
+     * @brief The number of samples kept.
+     */
+    size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    /**
+     * @brief Returns a kept sample, 0 being the oldest.
+     */
+    const Sample &operator[](size_t i) const noexcept
+    {
+        return samples_[(first_ + i) % capacity_];
+    }
+
+    /**
+     * @brief Writes the kept samples to the file as CSV, the oldest first, after a header line.
+     *
+     * @return Returns 0 on success, or -1 on failure with errno set.
+     */
+    int write() const noexcept
+    {
+        char buffer[1 << 16];
+        size_t used = snprintf(buffer, sizeof(buffer), "time_us,rss_kb,minor_faults,major_faults,cpu_time_us\n");
+        for (size_t i = 0; i <= size_; i++)
+        {
+            // Flush before a line could no longer fit, and at the end.
+            if (i == size_ || used > sizeof(buffer) - 128)
+            {
+                for (size_t written = 0; written < used;)
+                {
+                    auto n = ::write(output_, buffer + written, used - written);
+                    if (n < 0 && errno != EINTR)
+                    {
+                        return -1;
+                    }
+                    written += n > 0 ? n : 0;
+                }
+                used = 0;
+            }
+            if (i < size_)
+            {
+                auto &sample = (*this)[i];
+                used += snprintf(buffer + used, sizeof(buffer) - used, "%lld,%ld,%ld,%ld,%lld\n", sample.time,
+                                 sample.resident, sample.minorFaults, sample.majorFaults, sample.cpuTime);
+            }
+        }
+        return 0;
+    }
+
+  private:
+    std::unique_ptr<Sample[]> samples_;
+    size_t capacity_ = 0;
+    int interval_ = 1000;
+    size_t first_ = 0;
+    size_t size_ = 0;
+    int output_ = -1;
+    int stat_ = -1;
+    clockid_t cpuClock_{};
+    bool hasCpuClock_ = false;
+    long long start_ = 0;
+};
+} // namespace bsdbx
+
+#endif // TIMELINE_H
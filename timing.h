@@ -0,0 +1,56 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "monitor.h"
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace bsdbx
+{
+
+/**
+ * @brief Breaks the fixed cost of a run down into its phases.
+ *
+ * Every call to lap() closes the current phase and opens the next one. Taking a lap is a vDSO clock read, so the
+ * timer is always running and only printed on request.
+ */
+class PhaseTimer
+{
+  public:
+    PhaseTimer() noexcept : last_(monotonicMicros())
+    {
+    }
+
+    /**
+     * @brief Closes the current phase.
+     *
+     * @param name The name of the phase, which has to outlive the timer.
+     */
+    void lap(const char *name)
+    {
+        auto now = monotonicMicros();
+        phases_.emplace_back(name, now - last_);
+        last_ = now;
+    }
+
+    /**
+     * @brief Prints the phases as a single line of name=microseconds pairs.
+     */
+    void print(std::ostream &out) const
+    {
+        out << "timing";
+        for (auto &phase : phases_)
+        {
+            out << ' ' << phase.first << '=' << phase.second;
+        }
+        out << std::endl;
+    }
+
+  private:
+    long long last_;
+    std::vector<std::pair<const char *, long long>> phases_;
+};
+} // namespace bsdbx
+
+#endif // TIMING_H
@@ -0,0 +1,218 @@
+#include "stats.h"
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string.h>
+#include <string>
+#include <string_view>
+
+// Prints the live statistics which the bsdbx processes of a user publish with --live-stats.
+//
+// Each user publishes to a segment of their own, /bsdbx-stats-<uid>. The reader picks the segment of its real user,
+// or that of --uid=N, e.g. for a monitor reading the statistics of the judge account.
+//
+// The reader maps the segment read-only and never blocks the publishers. Every line is a slot owned by a bsdbx
+// process, with its counters since the process started, followed by the total of the host. The counters are
+// cumulative, so a monitor scrapes them periodically and computes rates from the difference of two scrapes.
+
+namespace
+{
+
+using namespace bsdbx;
+
+/**
+ * @brief A consistent-enough copy of a slot, or of the total of several.
+ */
+struct Snapshot
+{
+    int pid = 0;
+    bool alive = false;
+    long long running = 0, runs = 0, wallTime = 0, cpuTime = 0, samples = 0, missedSamples = 0;
+    long long verdicts[LIVE_STATS_VERDICT_COUNT] = {};
+    long long wallTimeBuckets[LIVE_STATS_BUCKETS] = {};
+
+    void add(const Snapshot &other)
+    {
+        running += other.running;
+        runs += other.runs;
+        wallTime += other.wallTime;
+        cpuTime += other.cpuTime;
+        samples += other.samples;
+        missedSamples += other.missedSamples;
+        for (int i = 0; i < LIVE_STATS_VERDICT_COUNT; i++)
+        {
+            verdicts[i] += other.verdicts[i];
+        }
+        for (int i = 0; i < LIVE_STATS_BUCKETS; i++)
+        {
+            wallTimeBuckets[i] += other.wallTimeBuckets[i];
+        }
+    }
+
+    /**
+     * @brief Returns the upper bound in miliseconds of the bucket holding the given quantile of the wall times, 0
+     * without any run, or -1 if it is the last, unbounded one.
+     */
+    long long quantile(double p) const
+    {
+        if (runs == 0)
+        {
+            return 0;
+        }
+        long long seen = 0;
+        for (int i = 0; i < LIVE_STATS_BUCKETS - 1; i++)
+        {
+            seen += wallTimeBuckets[i];
+            if (seen > 0 && seen >= p * runs)
+            {
+                return 1LL << i;
+            }
+        }
+        return -1;
+    }
+};
+
+Snapshot load(const LiveSlot &slot)
+{
+    Snapshot snapshot;
+    snapshot.pid = slot.pid.load(std::memory_order_acquire);
+    snapshot.alive = snapshot.pid != 0 && (kill(snapshot.pid, 0) == 0 || errno == EPERM);
+    snapshot.running = slot.running.load(std::memory_order_relaxed);
+    snapshot.runs = slot.runs.load(std::memory_order_relaxed);
+    snapshot.wallTime = slot.wallTime.load(std::memory_order_relaxed);
+    snapshot.cpuTime = slot.cpuTime.load(std::memory_order_relaxed);
+    snapshot.samples = slot.samples.load(std::memory_order_relaxed);
+    snapshot.missedSamples = slot.missedSamples.load(std::memory_order_relaxed);
+    for (int i = 0; i < LIVE_STATS_VERDICT_COUNT; i++)
+    {
+        snapshot.verdicts[i] = slot.verdicts[i].load(std::memory_order_relaxed);
+    }
+    for (int i = 0; i < LIVE_STATS_BUCKETS; i++)
+    {
+        snapshot.wallTimeBuckets[i] = slot.wallTimeBuckets[i].load(std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+void print(std::ostream &out, const std::string &name, const Snapshot &snapshot)
+{
+    out << std::left << std::setw(10) << name << std::right << std::setw(8) << snapshot.running << std::setw(10)
+        << snapshot.runs;
+    for (auto count : snapshot.verdicts)
+    {
+        out << std::setw(8) << count;
+    }
+    double runs = snapshot.runs > 0 ? snapshot.runs : 1;
+    double samples = snapshot.samples + snapshot.missedSamples > 0 ? snapshot.samples + snapshot.missedSamples : 1;
+    out << std::fixed << std::setprecision(1) << std::setw(10) << snapshot.wallTime / runs / 1000 << std::setw(10)
+        << snapshot.cpuTime / runs / 1000 << std::setw(8) << snapshot.quantile(0.5) << std::setw(8)
+        << snapshot.quantile(0.9) << std::setw(10) << 100.0 * snapshot.missedSamples / samples << std::endl;
+}
+
+std::string json(const Snapshot &snapshot)
+{
+    std::string result = "{";
+    if (snapshot.pid != 0)
+    {
+        result += "\"pid\":" + std::to_string(snapshot.pid) + ",\"alive\":" + (snapshot.alive ? "true" : "false") + ",";
+    }
+    result += "\"running\":" + std::to_string(snapshot.running) + ",\"runs\":" + std::to_string(snapshot.runs) +
+              ",\"verdicts\":{";
+    for (int i = 0; i < LIVE_STATS_VERDICT_COUNT; i++)
+    {
+        result += std::string(i > 0 ? "," : "") + "\"" + LIVE_STATS_VERDICTS[i] +
+                  "\":" + std::to_string(snapshot.verdicts[i]);
+    }
+    result += "},\"wall_time_us\":" + std::to_string(snapshot.wallTime) +
+              ",\"cpu_time_us\":" + std::to_string(snapshot.cpuTime) + ",\"wall_time_buckets\":[";
+    for (int i = 0; i < LIVE_STATS_BUCKETS; i++)
+    {
+        result += std::string(i > 0 ? "," : "") + std::to_string(snapshot.wallTimeBuckets[i]);
+    }
+    result += "],\"samples\":" + std::to_string(snapshot.samples) +
+              ",\"missed_samples\":" + std::to_string(snapshot.missedSamples) + "}";
+    return result;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    bool asJson = false;
+    uid_t uid = getuid();
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg(argv[i]);
+        if (arg == "--json")
+        {
+            asJson = true;
+        }
+        else if (arg.substr(0, 6) == "--uid=")
+        {
+            uid = std::stoul(std::string(arg.substr(6)));
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown argument: " + std::string(arg));
+        }
+    }
+
+    auto name = liveStatsName(uid);
+    auto segment = mapLiveStats(false, uid);
+    if (segment == nullptr)
+    {
+        std::cerr << "Failed to open the live statistics " << name << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    if (segment->magic.load(std::memory_order_acquire) != LIVE_STATS_MAGIC ||
+        segment->version != LIVE_STATS_VERSION || segment->slots != LIVE_STATS_SLOTS ||
+        segment->buckets != LIVE_STATS_BUCKETS)
+    {
+        std::cerr << "The live statistics " << name << " have an unknown layout" << std::endl;
+        return 1;
+    }
+
+    Snapshot total;
+    std::string slots;
+    if (!asJson)
+    {
+        std::cout << std::left << std::setw(10) << "pid" << std::right << std::setw(8) << "running" << std::setw(10)
+                  << "runs";
+        for (auto verdict : LIVE_STATS_VERDICTS)
+        {
+            std::cout << std::setw(8) << verdict;
+        }
+        std::cout << std::setw(10) << "wall (ms)" << std::setw(10) << "cpu (ms)" << std::setw(8) << "p50<"
+                  << std::setw(8) << "p90<" << std::setw(10) << "missed %" << std::endl;
+    }
+    for (auto &slot : segment->slot)
+    {
+        auto snapshot = load(slot);
+        if (snapshot.pid == 0)
+        {
+            continue;
+        }
+        if (!snapshot.alive)
+        {
+            // The owner died without releasing its slot, the commands it counted as running are gone.
+            snapshot.running = 0;
+        }
+        total.add(snapshot);
+        if (asJson)
+        {
+            slots += (slots.empty() ? "" : ",") + json(snapshot);
+        }
+        else
+        {
+            print(std::cout, std::to_string(snapshot.pid) + (snapshot.alive ? "" : "*"), snapshot);
+        }
+    }
+    if (asJson)
+    {
+        std::cout << "{\"slots\":[" << slots << "],\"total\":" << json(total) << "}" << std::endl;
+    }
+    else
+    {
+        print(std::cout, "total", total);
+    }
+    return 0;
+}